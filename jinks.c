@@ -23,10 +23,40 @@ void jx_destroy_range(jx_destructor destroy, int count, size_t sz,
   }
 }
 
+/* malloc already guarantees this much */
+#define DEFAULT_ALIGN (2*sizeof(void*))
+
+void* jx_aligned_alloc(size_t align, size_t sz) {
+  void *ptr;
+
+  assert(0 == (align & (align - 1)) && "Alignment must be a power of two.");
+  if (align <= DEFAULT_ALIGN) return malloc(sz);
+  /* pad to whole alignment units */
+  sz = (sz + align - 1) & ~(align - 1);
+  if (0 != posix_memalign(&ptr, align, sz ? sz : align)) return NULL;
+  return ptr;
+}
+
+void* jx_aligned_realloc(void *ptr, size_t used, size_t sz, size_t align) {
+  void *newptr;
+
+  assert(used <= sz && "Can't keep more bytes than the new size.");
+  if (align <= DEFAULT_ALIGN) return realloc(ptr, sz);
+
+  newptr = jx_aligned_alloc(align, sz);
+  if (NULL == newptr) return NULL;
+  if (ptr && used > 0) memcpy(newptr, ptr, used);
+  free(ptr);
+  return newptr;
+}
+
 const char* jx_get_error_message(jx_result result) {
   switch (result) {
     case JX_OK: return "Operation succeeded.";
     case JX_OUT_OF_MEMORY: return "Insufficient memory. Cannot proceed.";
+    case JX_CANNOT_OPEN_FILE: return "The file could not be opened.";
+    case JX_READ_FAILED: return "Reading from the file failed.";
+    case JX_INVALID_FORMAT: return "The input is not in the expected format.";
     default: return "An unknown error has occurred. This is bug.";
   }
 }
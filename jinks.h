@@ -7,6 +7,7 @@
 #define JINKS_H
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -51,6 +52,9 @@
 typedef enum {
   JX_OK = 0,
   JX_OUT_OF_MEMORY,
+  JX_CANNOT_OPEN_FILE,
+  JX_READ_FAILED,
+  JX_INVALID_FORMAT,
 } jx_result;
 
 const char* jx_get_error_message(jx_result result);
@@ -61,6 +65,10 @@ typedef void *jx_outptr;
 
 typedef void (*jx_destructor)(void *item);
 
+typedef int (*jx_compare)(const void *a, const void *b);
+
+typedef uint64_t (*jx_key_fn)(const void *item);
+
 /*******************************************************************************
  * Type definitions
  *
@@ -81,9 +89,17 @@ typedef struct {
     int refs;
     void *item;
     jx_destructor destroy;
+    /* set by a table that tracks the item (jx_intern): drops a reference in
+     * place of the plain decrement and returns the count left */
+    int (*release)(struct pointer_data *data);
+    void *owner;
   } *data;
 } jx_pointer;
 
+typedef struct {
+  struct pointer_data *data;
+} jx_atomic_pointer;
+
 typedef struct {
   int start, stride, count;
   jx_pointer ptr;
@@ -91,11 +107,106 @@ typedef struct {
 
 typedef struct {
   jx_destructor destroy;
-  size_t isz, cap;
+  size_t isz, cap, align, reserved;
   int size;
   unsigned char *data;
 } jx_vector;
 
+#define JX_VIEW_MAX_DIMS 8
+
+typedef struct {
+  int ndims, start;
+  int shape[JX_VIEW_MAX_DIMS];
+  int strides[JX_VIEW_MAX_DIMS];
+  size_t isz;
+  jx_pointer ptr;
+} jx_view;
+
+typedef struct {
+  struct pool_data *data;
+} jx_pool;
+
+typedef struct {
+  jx_vector cols;
+} jx_table;
+
+typedef struct {
+  jx_slice source;
+  size_t isz;
+  jx_vector stages;
+} jx_pipeline;
+
+typedef struct {
+  struct reader_data *data;
+} jx_reader;
+
+typedef struct {
+  struct intern_data *data;
+} jx_intern;
+
+typedef struct {
+  jx_vector items;
+  jx_destructor destroy;
+  jx_compare cmp;
+  int arity;
+  bool indexed;
+  int free_handle;
+  jx_vector ids, where;
+} jx_heap;
+
+typedef struct {
+  jx_destructor destroy;
+  jx_compare cmp;
+  size_t ksz, vsz, vals_at, kids_at, node_bytes;
+  int leaf_cap, inner_cap, size;
+  struct btree_node *root;
+} jx_btree;
+
+typedef struct {
+  const jx_btree *tree;
+  struct btree_node *leaf;
+  int pos;
+  const void *hi;
+} jx_btree_cursor;
+
+#define JX_INTVEC_BLOCK 128
+
+typedef struct {
+  bool sorted;
+  int size;
+  uint64_t last;
+  jx_vector blocks, words, tail;
+} jx_intvec;
+
+typedef struct {
+  const jx_intvec *vec;
+  int next;
+  uint64_t values[JX_INTVEC_BLOCK];
+} jx_intvec_cursor;
+
+typedef struct {
+  bool small;
+  unsigned char len;
+  union {
+    jx_vector vec;
+    char local[sizeof(jx_vector)];
+  } buf;
+} jx_string;
+
+typedef struct {
+  jx_destructor destroy;
+  size_t isz;
+  int shift, size;
+  jx_vector chunks;
+} jx_segvec;
+
+typedef struct {
+  int size, cap;
+  uint64_t *words;
+  bool indexed;
+  jx_vector ranks;
+} jx_bitvec;
+
 /******************************************************************************/
 
 /* Debug Validation Macros */
@@ -144,6 +255,18 @@ void jx_destroy(jx_destructor destroy, void *item);
 
 void jx_destroy_range(jx_destructor destroy, int count, size_t sz, void *items);
 
+/* Memory with a given alignment (a power of two, 0 for malloc's default).
+ * Aligned blocks are padded to a whole number of alignment units, so that a
+ * block aligned to JX_CACHE_LINE never shares a cache line with another
+ * allocation. Blocks are released with free. Since realloc can't keep an
+ * alignment, jx_aligned_realloc copies the first 'used' bytes by hand. */
+
+#define JX_CACHE_LINE 64
+
+void* jx_aligned_alloc(size_t align, size_t sz);
+
+void* jx_aligned_realloc(void *ptr, size_t used, size_t sz, size_t align);
+
 /******************************************************************************/
 
 /* Unit testing support */
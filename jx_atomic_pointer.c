@@ -0,0 +1,262 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_atomic_pointer.h"
+#include "jx_pointer.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(__atomic_load_n(&self->data, __ATOMIC_RELAXED))
+
+/* One per thread that has loaded from a cell. Slots are never freed, a
+ * thread that exits hands its slot on to the next thread that needs one. */
+struct hazard {
+  struct pointer_data *ptr;
+  int busy;
+  struct hazard *next;
+};
+
+static struct hazard *hazards = NULL;
+
+static __thread struct hazard *mine = NULL;
+
+static pthread_key_t release_key;
+static pthread_once_t release_once = PTHREAD_ONCE_INIT;
+
+static void release_slot(void *slot) {
+  struct hazard *h = slot;
+  __atomic_store_n(&h->ptr, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&h->busy, 0, __ATOMIC_RELEASE);
+}
+
+static void make_release_key() {
+  pthread_key_create(&release_key, release_slot);
+}
+
+static struct hazard* my_slot() {
+  struct hazard *h;
+  int idle = 0;
+
+  if (mine) return mine;
+  pthread_once(&release_once, make_release_key);
+
+  /* take over a slot left by a thread that has exited */
+  for (h = __atomic_load_n(&hazards, __ATOMIC_ACQUIRE); h; h = h->next) {
+    idle = 0;
+    if (__atomic_compare_exchange_n(&h->busy, &idle, 1, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (NULL == h) {
+    h = malloc(sizeof *h);
+    if (NULL == h) return NULL;
+    h->ptr = NULL;
+    h->busy = 1;
+    h->next = __atomic_load_n(&hazards, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&hazards, &h->next, h, true,
+          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+  pthread_setspecific(release_key, h);
+  mine = h;
+  return h;
+}
+
+/* Wait until no reader is about to clone ptr. The caller has swapped ptr out
+ * of its cell and no longer holds it there, so no new reader can announce
+ * it. */
+static void wait_for_readers(const struct pointer_data *ptr) {
+  struct hazard *h;
+
+  for (h = __atomic_load_n(&hazards, __ATOMIC_ACQUIRE); h; h = h->next) {
+    while (__atomic_load_n(&h->ptr, __ATOMIC_SEQ_CST) == ptr) {
+      sched_yield();
+    }
+  }
+}
+
+/******************************************************************************/
+
+void jx_atomic_pointer_init(jx_atomic_pointer *out_self,
+    const jx_pointer *initial) {
+  jx_pointer clone;
+
+  JX_NOT_NULL(out_self);
+  jx_pointer_clone(initial, &clone);
+  out_self->data = clone.data;
+}
+
+void jx_atomic_pointer_destroy(void *atomic_pointer) {
+  jx_atomic_pointer *self = atomic_pointer;
+  jx_pointer old;
+  VALID(self);
+
+  old.data = __atomic_exchange_n(&self->data, NULL, __ATOMIC_SEQ_CST);
+  wait_for_readers(old.data);
+  jx_pointer_destroy(&old);
+}
+
+/******************************************************************************/
+
+jx_result jx_atomic_pointer_load(const jx_atomic_pointer *self,
+    jx_pointer *out_ptr) {
+  struct hazard *h = my_slot();
+  jx_pointer current;
+
+  VALID(self);
+  JX_NOT_NULL(out_ptr);
+  if (NULL == h) return JX_OUT_OF_MEMORY;
+
+  /* announce the pointer, then check that it is still the cell's: if so, a
+   * writer swapping it out from now on will see the announcement and wait */
+  do {
+    current.data = __atomic_load_n(&self->data, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&h->ptr, current.data, __ATOMIC_SEQ_CST);
+  } while (__atomic_load_n(&self->data, __ATOMIC_SEQ_CST) != current.data);
+
+  jx_pointer_clone(&current, out_ptr);
+  __atomic_store_n(&h->ptr, NULL, __ATOMIC_RELEASE);
+  return JX_OK;
+}
+
+void jx_atomic_pointer_store(jx_atomic_pointer *self, const jx_pointer *ptr) {
+  jx_pointer old;
+
+  jx_atomic_pointer_exchange(self, ptr, &old);
+  jx_pointer_destroy(&old);
+}
+
+void jx_atomic_pointer_exchange(jx_atomic_pointer *self, const jx_pointer *ptr,
+    jx_pointer *out_old) {
+  jx_pointer clone;
+
+  VALID(self);
+  JX_NOT_NULL(out_old);
+
+  jx_pointer_clone(ptr, &clone);
+  out_old->data = __atomic_exchange_n(&self->data, clone.data,
+      __ATOMIC_SEQ_CST);
+  /* the reference is only safe to hand on once readers are done with it.
+   * Storing the same pointer again leaves it in the cell, where readers can
+   * keep announcing it, but the cell's new clone keeps it alive. */
+  if (out_old->data != clone.data) wait_for_readers(out_old->data);
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+struct config {
+  int version;
+  int check;
+};
+
+static int configs_destroyed;
+
+static void destroy_config(void *item) {
+  struct config *c = item;
+  c->check = -1;
+  __atomic_add_fetch(&configs_destroyed, 1, __ATOMIC_RELAXED);
+}
+
+static jx_result make_config(jx_pointer *out_ptr, int version) {
+  struct config *c;
+
+  JX_TRY(jx_pointer_init(out_ptr, sizeof *c, destroy_config));
+  c = jx_pointer_get(out_ptr);
+  c->version = version;
+  c->check = 3 * version;
+  return JX_OK;
+}
+
+static jx_atomic_pointer current_config;
+
+jx_test atomic_pointer_swap() {
+  jx_pointer a, b, got, old;
+
+  configs_destroyed = 0;
+  JX_CATCH(make_config(&a, 1));
+  JX_CATCH(make_config(&b, 2));
+  jx_atomic_pointer_init(&current_config, &a);
+
+  JX_CATCH(jx_atomic_pointer_load(&current_config, &got));
+  JX_EXPECT(jx_pointer_get(&got) == jx_pointer_get(&a),
+      "Load returned the wrong reference.");
+  jx_pointer_destroy(&got);
+
+  jx_atomic_pointer_exchange(&current_config, &b, &old);
+  JX_EXPECT(jx_pointer_get(&old) == jx_pointer_get(&a),
+      "Exchange returned the wrong reference.");
+  jx_pointer_destroy(&old);
+  jx_pointer_destroy(&a);
+  JX_EXPECT(1 == configs_destroyed, "The old config wasn't released.");
+
+  jx_atomic_pointer_store(&current_config, &b);
+  jx_pointer_destroy(&b);
+  JX_EXPECT(1 == configs_destroyed, "The cell lost its reference.");
+  jx_atomic_pointer_destroy(&current_config);
+  JX_EXPECT(2 == configs_destroyed, "The cell didn't release its reference.");
+  return JX_PASS;
+}
+
+static int readers_done, torn_reads;
+
+static void* read_configs(void *arg) {
+  struct config *c;
+  jx_pointer got;
+  int last = 0;
+
+  while (!__atomic_load_n(&readers_done, __ATOMIC_ACQUIRE)) {
+    if (JX_OK != jx_atomic_pointer_load(&current_config, &got)) continue;
+    c = jx_pointer_get(&got);
+    if (c->check != 3 * c->version || c->version < last) {
+      __atomic_add_fetch(&torn_reads, 1, __ATOMIC_RELAXED);
+    }
+    last = c->version;
+    jx_pointer_destroy(&got);
+  }
+  return NULL;
+}
+
+jx_test atomic_pointer_readers() {
+  pthread_t readers[4];
+  jx_pointer next;
+  int i, started;
+
+  configs_destroyed = 0;
+  readers_done = 0;
+  torn_reads = 0;
+  JX_CATCH(make_config(&next, 0));
+  jx_atomic_pointer_init(&current_config, &next);
+  jx_pointer_destroy(&next);
+
+  for (started = 0; started < 4; ++started) {
+    if (0 != pthread_create(&readers[started], NULL, read_configs, NULL)) {
+      break;
+    }
+  }
+  for (i = 1; i <= 2000; ++i) {
+    JX_CATCH(make_config(&next, i));
+    jx_atomic_pointer_store(&current_config, &next);
+    /* storing it again leaves it in the cell, so must not wait on readers */
+    jx_atomic_pointer_store(&current_config, &next);
+    jx_pointer_destroy(&next);
+  }
+  __atomic_store_n(&readers_done, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < started; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+
+  JX_EXPECT(0 == torn_reads, "A reader saw a released config.");
+  JX_EXPECT(2000 == configs_destroyed,
+      "Every replaced config should be released.");
+  jx_atomic_pointer_destroy(&current_config);
+  JX_EXPECT(2001 == configs_destroyed, "The last config wasn't released.");
+  return JX_PASS;
+}
+
+#endif
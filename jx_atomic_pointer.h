@@ -0,0 +1,40 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_ATOMIC_POINTER_H
+#define JX_ATOMIC_POINTER_H
+#include "jinks.h"
+
+/* A cell holding a reference (jx_pointer) that threads can read and replace
+ * at the same time: for configuration and other read-mostly data that is
+ * swapped out whole. Readers never lock. They announce the pointer they are
+ * about to clone in a hazard slot of their own, and a writer that has just
+ * swapped a pointer out waits for any reader still announcing it before it
+ * lets go of its reference. That wait is only ever a few instructions long. */
+
+void jx_atomic_pointer_init(jx_atomic_pointer *out_self,
+    const jx_pointer *initial);
+
+/* Must not race with other calls on the same cell. */
+void jx_atomic_pointer_destroy(void *atomic_pointer);
+
+/******************************************************************************/
+
+/* Clone the current reference into out_ptr. The first load on a thread sets
+ * up its hazard slot.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_atomic_pointer_load(const jx_atomic_pointer *self,
+    jx_pointer *out_ptr);
+
+/* Replace the reference with a clone of ptr, releasing the old one. */
+void jx_atomic_pointer_store(jx_atomic_pointer *self, const jx_pointer *ptr);
+
+/* Replace the reference with a clone of ptr and hand the old one over to
+ * out_old. */
+void jx_atomic_pointer_exchange(jx_atomic_pointer *self, const jx_pointer *ptr,
+    jx_pointer *out_old);
+
+#endif /* end of header guard */
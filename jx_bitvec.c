@@ -0,0 +1,470 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_bitvec.h"
+#include "jx_vector.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#define VALID(self) \
+  JX_NOT_NEG(self->size); \
+  JX_ARRAY_SZ(self->cap, self->words); \
+  assert(self->size <= self->cap && "Invalid object: size exceeds capacity.")
+
+#define WORD_BITS 64
+/* words per entry of the rank index: one entry per cache line */
+#define BLOCK_WORDS 8
+
+#define WORDS(bits) (((bits) + WORD_BITS - 1) / WORD_BITS)
+#define BIT(i) ((uint64_t)1 << ((i) % WORD_BITS))
+
+/* The counting loops are built twice, with and without POPCNT, since the
+ * default flags don't assume it. Which one runs is picked from what the CPU
+ * supports, once, when the program is loaded. */
+static bool has_popcnt;
+
+__attribute__((constructor)) static void detect_popcnt() {
+  __builtin_cpu_init();
+  has_popcnt = __builtin_cpu_supports("popcnt");
+}
+
+/* the bits set in the n words at words */
+static inline __attribute__((always_inline)) int count_loop(
+    const uint64_t *words, int n) {
+  int k, count = 0;
+
+  for (k = 0; k < n; ++k) {
+    count += __builtin_popcountll(words[k]);
+  }
+  return count;
+}
+
+/* The word, of those at words, holding the set bit with rank *r, which is
+ * left as that bit's rank within the word. */
+static inline __attribute__((always_inline)) int find_loop(
+    const uint64_t *words, int *r) {
+  int w, c;
+
+  for (w = 0; ; ++w) {
+    c = __builtin_popcountll(words[w]);
+    if (*r < c) return w;
+    *r -= c;
+  }
+}
+
+__attribute__((target("popcnt"))) static int count_words_popcnt(
+    const uint64_t *words, int n) {
+  return count_loop(words, n);
+}
+
+__attribute__((target("popcnt"))) static int find_word_popcnt(
+    const uint64_t *words, int *r) {
+  return find_loop(words, r);
+}
+
+static int count_words(const uint64_t *words, int n) {
+  return (has_popcnt ? count_words_popcnt(words, n) : count_loop(words, n));
+}
+
+static int find_word(const uint64_t *words, int *r) {
+  return (has_popcnt ? find_word_popcnt(words, r) : find_loop(words, r));
+}
+
+jx_result jx_bitvec_init(jx_bitvec *out_self, int capacity) {
+  JX_NOT_NULL(out_self);
+  JX_NOT_NEG(capacity);
+
+  out_self->size = 0;
+  out_self->cap = 0;
+  out_self->words = NULL;
+  out_self->indexed = false;
+  /* an empty vector doesn't allocate, this can't fail */
+  jx_vector_init(&out_self->ranks, sizeof(int), 0, NULL);
+
+  VALID(out_self);
+  return jx_bitvec_reserve(out_self, capacity);
+}
+
+jx_result jx_bitvec_from_bools(jx_bitvec *out_self, const jx_vector *bools) {
+  const bool *flags;
+  int i, n;
+
+  JX_NOT_NULL(bools);
+  assert(sizeof(bool) == bools->isz && "Expected a vector of bool.");
+
+  n = jx_vector_size(bools);
+  JX_TRY(jx_bitvec_init(out_self, n));
+  JX_TRY(jx_bitvec_resize(out_self, n));
+  flags = jx_vector_data(bools);
+  for (i = 0; i < n; ++i) {
+    if (flags[i]) out_self->words[i / WORD_BITS] |= BIT(i);
+  }
+  return JX_OK;
+}
+
+void jx_bitvec_destroy(void *bitvec) {
+  jx_bitvec *self = bitvec;
+  VALID(self);
+
+  free(self->words);
+  jx_vector_destroy(&self->ranks);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+int jx_bitvec_size(const jx_bitvec *self) {
+  VALID(self);
+  return self->size;
+}
+
+int jx_bitvec_capacity(const jx_bitvec *self) {
+  VALID(self);
+  return self->cap;
+}
+
+jx_result jx_bitvec_reserve(jx_bitvec *self, int num) {
+  int cap;
+  uint64_t *newwords;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+
+  cap = self->cap;
+  while (cap < num) cap = (cap ? cap << 1 : WORD_BITS);
+  if (cap > self->cap) {
+    newwords = realloc(self->words, WORDS(cap) * sizeof *newwords);
+    if (NULL == newwords) return JX_OUT_OF_MEMORY;
+    self->cap = cap;
+    self->words = newwords;
+  }
+
+  return JX_OK;
+}
+
+jx_result jx_bitvec_resize(jx_bitvec *self, int size) {
+  int used, need;
+
+  VALID(self);
+  JX_NOT_NEG(size);
+
+  JX_TRY(jx_bitvec_reserve(self, size));
+  used = WORDS(self->size);
+  need = WORDS(size);
+  if (need > used) {
+    memset(&self->words[used], 0, (need - used) * sizeof *self->words);
+  }
+  /* bits past the end are always kept clear */
+  if (size % WORD_BITS) {
+    self->words[size / WORD_BITS] &= BIT(size) - 1;
+  }
+  self->size = size;
+  self->indexed = false;
+  return JX_OK;
+}
+
+jx_result jx_bitvec_append(jx_bitvec *self, bool bit) {
+  VALID(self);
+
+  JX_TRY(jx_bitvec_resize(self, self->size + 1));
+  if (bit) jx_bitvec_set(self, self->size - 1);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+bool jx_bitvec_test(const jx_bitvec *self, int i) {
+  VALID(self);
+  JX_RANGE(i, 0, self->size);
+  return (self->words[i / WORD_BITS] & BIT(i)) != 0;
+}
+
+void jx_bitvec_set(jx_bitvec *self, int i) {
+  VALID(self);
+  JX_RANGE(i, 0, self->size);
+  self->words[i / WORD_BITS] |= BIT(i);
+  self->indexed = false;
+}
+
+void jx_bitvec_clear(jx_bitvec *self, int i) {
+  VALID(self);
+  JX_RANGE(i, 0, self->size);
+  self->words[i / WORD_BITS] &= ~BIT(i);
+  self->indexed = false;
+}
+
+void jx_bitvec_assign(jx_bitvec *self, int i, bool bit) {
+  if (bit) {
+    jx_bitvec_set(self, i);
+  } else {
+    jx_bitvec_clear(self, i);
+  }
+}
+
+void jx_bitvec_fill(jx_bitvec *self, bool bit) {
+  int n;
+
+  VALID(self);
+  n = WORDS(self->size);
+  memset(self->words, bit ? 0xff : 0, n * sizeof *self->words);
+  if (bit && self->size % WORD_BITS) {
+    self->words[n-1] = BIT(self->size) - 1;
+  }
+  self->indexed = false;
+}
+
+/******************************************************************************/
+
+/* The loops below are simple enough for the compiler to vectorize. None of
+ * them can set a bit past the end, since those bits are clear in both. */
+#define WORDWISE(self, other, expr) \
+  uint64_t *a; \
+  const uint64_t *b; \
+  int k, n; \
+  VALID(self); \
+  VALID(other); \
+  assert(self->size == other->size && "Bit vectors differ in size."); \
+  a = self->words; \
+  b = other->words; \
+  n = WORDS(self->size); \
+  for (k = 0; k < n; ++k) { \
+    a[k] = (expr); \
+  } \
+  self->indexed = false
+
+void jx_bitvec_and(jx_bitvec *self, const jx_bitvec *other) {
+  WORDWISE(self, other, a[k] & b[k]);
+}
+
+void jx_bitvec_or(jx_bitvec *self, const jx_bitvec *other) {
+  WORDWISE(self, other, a[k] | b[k]);
+}
+
+void jx_bitvec_xor(jx_bitvec *self, const jx_bitvec *other) {
+  WORDWISE(self, other, a[k] ^ b[k]);
+}
+
+void jx_bitvec_andnot(jx_bitvec *self, const jx_bitvec *other) {
+  WORDWISE(self, other, a[k] & ~b[k]);
+}
+
+#undef WORDWISE
+
+/******************************************************************************/
+
+int jx_bitvec_popcount(const jx_bitvec *self) {
+  VALID(self);
+  return count_words(self->words, WORDS(self->size));
+}
+
+int jx_bitvec_next(const jx_bitvec *self, int i) {
+  uint64_t w;
+  int k, n;
+
+  VALID(self);
+  JX_NOT_NEG(i);
+
+  if (i >= self->size) return -1;
+  n = WORDS(self->size);
+  k = i / WORD_BITS;
+  /* drop the bits before i in the first word */
+  w = self->words[k] & ~(BIT(i) - 1);
+  while (0 == w) {
+    if (++k == n) return -1;
+    w = self->words[k];
+  }
+  return k * WORD_BITS + __builtin_ctzll(w);
+}
+
+jx_result jx_bitvec_build_index(jx_bitvec *self) {
+  int *ranks;
+  int k, n, blocks, count = 0;
+
+  VALID(self);
+
+  /* ranks[b] counts the bits set before block b. There is one extra entry,
+   * the total, which bounds the search in select. */
+  n = WORDS(self->size);
+  blocks = (n + BLOCK_WORDS - 1) / BLOCK_WORDS;
+  jx_vector_clear(&self->ranks);
+  JX_TRY(jx_vector_append(&self->ranks, blocks + 1, &ranks));
+  for (k = 0; k < n; k += BLOCK_WORDS) {
+    ranks[k / BLOCK_WORDS] = count;
+    count += count_words(&self->words[k],
+        n - k < BLOCK_WORDS ? n - k : BLOCK_WORDS);
+  }
+  ranks[blocks] = count;
+
+  self->indexed = true;
+  return JX_OK;
+}
+
+int jx_bitvec_rank(const jx_bitvec *self, int i) {
+  const int *ranks;
+  uint64_t last;
+  int k, count;
+
+  VALID(self);
+  JX_RANGE(i, 0, self->size+1);
+  assert(self->indexed && "The rank index is missing or stale.");
+
+  ranks = jx_vector_data(&self->ranks);
+  k = (i / WORD_BITS / BLOCK_WORDS) * BLOCK_WORDS;
+  count = ranks[k / BLOCK_WORDS];
+  count += count_words(&self->words[k], i / WORD_BITS - k);
+  if (i % WORD_BITS) {
+    last = self->words[i / WORD_BITS] & (BIT(i) - 1);
+    count += count_words(&last, 1);
+  }
+  return count;
+}
+
+/* the position of the set bit of w with rank r */
+static int select_in_word(uint64_t w, int r) {
+#ifdef __BMI2__
+  return __builtin_ctzll(_pdep_u64((uint64_t)1 << r, w));
+#else
+  while (r-- > 0) w &= w - 1;
+  return __builtin_ctzll(w);
+#endif
+}
+
+int jx_bitvec_select(const jx_bitvec *self, int k) {
+  const int *ranks;
+  int lo, hi, mid, w, blocks;
+
+  VALID(self);
+  JX_NOT_NEG(k);
+  assert(self->indexed && "The rank index is missing or stale.");
+
+  blocks = jx_vector_size(&self->ranks) - 1;
+  ranks = jx_vector_data(&self->ranks);
+  if (k >= ranks[blocks]) return -1;
+
+  /* the last block that starts with no more than k bits before it */
+  lo = 0;
+  hi = blocks - 1;
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (ranks[mid] <= k) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  k -= ranks[lo];
+  w = lo * BLOCK_WORDS + find_word(&self->words[lo * BLOCK_WORDS], &k);
+  return w * WORD_BITS + select_in_word(self->words[w], k);
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_bitvec bits_var, *bits = &bits_var;
+static jx_bitvec bits_var2, *bits2 = &bits_var2;
+
+jx_test bitvec_set_and_test() {
+  int i;
+
+  JX_CATCH(jx_bitvec_init(bits, 10));
+  JX_EXPECT(0 == jx_bitvec_size(bits), "A new bit vector should be empty.");
+  JX_EXPECT(10 <= jx_bitvec_capacity(bits), "Capacity wasn't reserved.");
+
+  for (i = 0; i < 200; ++i) {
+    JX_CATCH(jx_bitvec_append(bits, i % 3 == 0));
+  }
+  JX_EXPECT(200 == jx_bitvec_size(bits), "Incorrect size after appending.");
+  for (i = 0; i < 200; ++i) {
+    JX_EXPECT(jx_bitvec_test(bits, i) == (i % 3 == 0), "Incorrect bit.");
+  }
+  JX_EXPECT(67 == jx_bitvec_popcount(bits), "Incorrect popcount.");
+
+  jx_bitvec_clear(bits, 3);
+  jx_bitvec_set(bits, 199);
+  JX_EXPECT(!jx_bitvec_test(bits, 3) && jx_bitvec_test(bits, 199),
+      "Set or clear didn't change the bit.");
+
+  /* shrinking then growing brings back clear bits */
+  JX_CATCH(jx_bitvec_resize(bits, 70));
+  JX_CATCH(jx_bitvec_resize(bits, 200));
+  for (i = 70; i < 200; ++i) {
+    JX_EXPECT(!jx_bitvec_test(bits, i), "Regrown bits should be clear.");
+  }
+
+  jx_bitvec_fill(bits, true);
+  JX_EXPECT(200 == jx_bitvec_popcount(bits), "Fill didn't set every bit.");
+
+  jx_bitvec_destroy(bits);
+  return JX_PASS;
+}
+
+jx_test bitvec_wordwise() {
+  jx_vector bools;
+  bool *flags;
+  int i, n = 300;
+
+  JX_CATCH(jx_vector_init(&bools, sizeof(bool), 0, NULL));
+  JX_CATCH(jx_vector_append(&bools, n, &flags));
+  for (i = 0; i < n; ++i) {
+    flags[i] = (i % 2 == 0);
+  }
+  JX_CATCH(jx_bitvec_from_bools(bits, &bools));
+  for (i = 0; i < n; ++i) {
+    flags[i] = (i % 3 == 0);
+  }
+  JX_CATCH(jx_bitvec_from_bools(bits2, &bools));
+  jx_vector_destroy(&bools);
+
+  jx_bitvec_and(bits, bits2);
+  for (i = 0; i < n; ++i) {
+    JX_EXPECT(jx_bitvec_test(bits, i) == (i % 6 == 0), "Incorrect and.");
+  }
+  jx_bitvec_xor(bits, bits2);
+  for (i = 0; i < n; ++i) {
+    JX_EXPECT(jx_bitvec_test(bits, i) == (i % 3 == 0 && i % 2 != 0),
+        "Incorrect xor.");
+  }
+  jx_bitvec_or(bits, bits2);
+  jx_bitvec_andnot(bits, bits2);
+  JX_EXPECT(0 == jx_bitvec_popcount(bits), "Incorrect or / andnot.");
+
+  jx_bitvec_destroy(bits);
+  jx_bitvec_destroy(bits2);
+  return JX_PASS;
+}
+
+jx_test bitvec_rank_select() {
+  int i, k, n = 5000;
+
+  JX_CATCH(jx_bitvec_init(bits, 0));
+  JX_CATCH(jx_bitvec_resize(bits, n));
+  for (i = 0; i < n; i += 7) {
+    jx_bitvec_set(bits, i);
+  }
+  JX_CATCH(jx_bitvec_build_index(bits));
+
+  for (i = 0; i <= n; ++i) {
+    JX_EXPECT(jx_bitvec_rank(bits, i) == (i + 6) / 7, "Incorrect rank.");
+  }
+  for (k = 0; k < (n + 6) / 7; ++k) {
+    JX_EXPECT(jx_bitvec_select(bits, k) == 7*k, "Incorrect select.");
+  }
+  JX_EXPECT(-1 == jx_bitvec_select(bits, k), "Select past the last bit.");
+
+  for (i = jx_bitvec_next(bits, 0), k = 0; i >= 0;
+      i = jx_bitvec_next(bits, i+1), ++k) {
+    JX_EXPECT(7*k == i, "Iteration skipped a set bit.");
+  }
+  JX_EXPECT((n + 6) / 7 == k, "Iteration missed set bits.");
+
+  jx_bitvec_destroy(bits);
+  return JX_PASS;
+}
+
+#endif
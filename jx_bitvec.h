@@ -0,0 +1,77 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_BITVEC_H
+#define JX_BITVEC_H
+#include "jinks.h"
+
+/* A growable vector of bits, packed 64 to a word. Sizes and capacities are
+ * counted in bits. */
+
+jx_result jx_bitvec_init(jx_bitvec *out_self, int capacity);
+
+jx_result jx_bitvec_from_bools(jx_bitvec *out_self, const jx_vector *bools);
+
+void jx_bitvec_destroy(void *bitvec);
+
+/******************************************************************************/
+
+int jx_bitvec_size(const jx_bitvec *self);
+
+int jx_bitvec_capacity(const jx_bitvec *self);
+
+jx_result jx_bitvec_reserve(jx_bitvec *self, int num);
+
+/* Grow (with clear bits) or truncate to size bits. */
+jx_result jx_bitvec_resize(jx_bitvec *self, int size);
+
+jx_result jx_bitvec_append(jx_bitvec *self, bool bit);
+
+/******************************************************************************/
+
+bool jx_bitvec_test(const jx_bitvec *self, int i);
+
+void jx_bitvec_set(jx_bitvec *self, int i);
+
+void jx_bitvec_clear(jx_bitvec *self, int i);
+
+void jx_bitvec_assign(jx_bitvec *self, int i, bool bit);
+
+void jx_bitvec_fill(jx_bitvec *self, bool bit);
+
+/******************************************************************************/
+
+/* Word-wise operations on two vectors of the same size, stored in self. */
+
+void jx_bitvec_and(jx_bitvec *self, const jx_bitvec *other);
+
+void jx_bitvec_or(jx_bitvec *self, const jx_bitvec *other);
+
+void jx_bitvec_xor(jx_bitvec *self, const jx_bitvec *other);
+
+void jx_bitvec_andnot(jx_bitvec *self, const jx_bitvec *other);
+
+/******************************************************************************/
+
+int jx_bitvec_popcount(const jx_bitvec *self);
+
+/* The index of the first set bit at or after i, or -1 if there isn't one.
+ * Visit all the set bits with:
+ *   for (i = jx_bitvec_next(bv, 0); i >= 0; i = jx_bitvec_next(bv, i+1)) */
+int jx_bitvec_next(const jx_bitvec *self, int i);
+
+/* Build the index used by rank and select. Any change to the bits makes the
+ * index stale, so it has to be built again before the next rank or select.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_bitvec_build_index(jx_bitvec *self);
+
+/* The number of set bits before bit i. */
+int jx_bitvec_rank(const jx_bitvec *self, int i);
+
+/* The index of the set bit with rank k, or -1 if there are not that many. */
+int jx_bitvec_select(const jx_bitvec *self, int k);
+
+#endif /* end of header guard */
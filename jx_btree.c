@@ -0,0 +1,828 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_btree.h"
+#include "jx_vector.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(self->root); \
+  JX_NOT_NEG(self->size); \
+  JX_POSITIVE(self->ksz); \
+  assert(self->leaf_cap >= 4 && self->inner_cap >= 4 && \
+      "Invalid object: nodes are too small.")
+
+/* smallest node, in cache lines. Nodes double until they hold enough. */
+#define NODE_LINES 4
+
+struct btree_node {
+  int count;
+  bool leaf;
+  /* the next leaf, in key order */
+  struct btree_node *next;
+};
+
+/* Nodes are the header, then count keys packed together (so a SIMD search
+ * reads them straight through), then the values or the count+1 children. */
+#define HEADER ((sizeof(struct btree_node) + 15) & ~(size_t)15)
+#define ROUND8(n) (((n) + 7) & ~(size_t)7)
+
+#define KEY(t, n, i) ((unsigned char*)(n) + HEADER + (size_t)(i)*(t)->ksz)
+#define VAL(t, n, i) \
+  ((unsigned char*)(n) + HEADER + (t)->vals_at + (size_t)(i)*(t)->vsz)
+#define KIDS(t, n) \
+  ((struct btree_node**)((unsigned char*)(n) + HEADER + (t)->kids_at))
+
+/* fewest entries a node other than the root may have */
+#define MIN_COUNT(t, n) ((n)->leaf ? (t)->leaf_cap/2 : ((t)->inner_cap - 1)/2)
+#define CAPACITY(t, n) ((n)->leaf ? (t)->leaf_cap : (t)->inner_cap)
+
+static struct btree_node* new_node(const jx_btree *self, bool leaf) {
+  struct btree_node *node = jx_aligned_alloc(JX_CACHE_LINE, self->node_bytes);
+  if (node) {
+    node->count = 0;
+    node->leaf = leaf;
+    node->next = NULL;
+  }
+  return node;
+}
+
+jx_result jx_btree_init(jx_btree *out_self, size_t ksz, size_t vsz,
+    jx_compare cmp, jx_destructor destroy) {
+  size_t bytes = NODE_LINES * JX_CACHE_LINE, room;
+
+  JX_NOT_NULL(out_self);
+  JX_POSITIVE(ksz);
+  assert((cmp || sizeof(uint32_t) == ksz || sizeof(uint64_t) == ksz) &&
+      "Without a comparison, keys must be 32 or 64 bit integers.");
+
+  out_self->ksz = ksz;
+  out_self->vsz = vsz;
+  out_self->cmp = cmp;
+  out_self->destroy = destroy;
+  out_self->size = 0;
+  /* leave 8 bytes of slack for aligning the values or the children */
+  for (;; bytes *= 2) {
+    room = bytes - HEADER - 8;
+    out_self->leaf_cap = (int)(room / (ksz + vsz));
+    out_self->inner_cap = (int)((room - sizeof(void*)) /
+        (ksz + sizeof(void*)));
+    if (out_self->leaf_cap >= 8 && out_self->inner_cap >= 8) break;
+  }
+  out_self->node_bytes = bytes;
+  out_self->vals_at = ROUND8(out_self->leaf_cap * ksz);
+  out_self->kids_at = ROUND8(out_self->inner_cap * ksz);
+
+  out_self->root = new_node(out_self, true);
+  if (NULL == out_self->root) return JX_OUT_OF_MEMORY;
+  VALID(out_self);
+  return JX_OK;
+}
+
+static void free_node(jx_btree *self, struct btree_node *node) {
+  int i;
+
+  if (NULL == node) return;
+  if (node->leaf) {
+    jx_destroy_range(self->destroy, node->count, self->vsz,
+        VAL(self, node, 0));
+  } else {
+    for (i = 0; i <= node->count; ++i) {
+      free_node(self, KIDS(self, node)[i]);
+    }
+  }
+  free(node);
+}
+
+void jx_btree_destroy(void *btree) {
+  jx_btree *self = btree;
+  VALID(self);
+
+  free_node(self, self->root);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+bool jx_btree_isempty(const jx_btree *self) {
+  VALID(self);
+  return !self->size;
+}
+
+int jx_btree_size(const jx_btree *self) {
+  VALID(self);
+  return self->size;
+}
+
+static int compare(const jx_btree *self, const void *a, const void *b) {
+  uint64_t x, y;
+
+  if (self->cmp) return self->cmp(a, b);
+  if (sizeof(uint32_t) == self->ksz) {
+    x = *(const uint32_t*)a;
+    y = *(const uint32_t*)b;
+  } else {
+    x = *(const uint64_t*)a;
+    y = *(const uint64_t*)b;
+  }
+  return (x > y) - (x < y);
+}
+
+/* The number of keys in node that are less than key (or, with or_equal,
+ * no greater). That is where key goes in a leaf, and which child holds it
+ * in an inner node (the separators are the smallest keys of the subtrees to
+ * their right). */
+static int rank(const jx_btree *self, const struct btree_node *node,
+    const void *key, bool or_equal) {
+  const unsigned char *keys = KEY(self, node, 0);
+  int lo = 0, hi = node->count, mid, c;
+
+  if (NULL == self->cmp) {
+#ifdef __AVX2__
+    /* compare the key with a whole register of keys at a time; there is no
+     * unsigned compare, so flip the sign bits first. Keys are sorted, so the
+     * matching lanes are a prefix. */
+    unsigned mask, full;
+    if (sizeof(uint64_t) == self->ksz) {
+      const __m256i flip = _mm256_set1_epi64x((long long)(1ull << 63));
+      const __m256i k = _mm256_xor_si256(flip,
+          _mm256_set1_epi64x(*(const long long*)key));
+      full = 0xffffffffu;
+      for (; lo + 4 <= hi; lo += 4) {
+        __m256i v = _mm256_xor_si256(flip,
+            _mm256_loadu_si256((const __m256i*)&keys[lo*8]));
+        mask = (unsigned)_mm256_movemask_epi8(or_equal ?
+            _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v));
+        if (or_equal) mask = ~mask;
+        if (mask != full) return lo + __builtin_popcount(mask) / 8;
+      }
+    } else {
+      const __m256i flip = _mm256_set1_epi32((int)(1u << 31));
+      const __m256i k = _mm256_xor_si256(flip,
+          _mm256_set1_epi32(*(const int*)key));
+      full = 0xffffffffu;
+      for (; lo + 8 <= hi; lo += 8) {
+        __m256i v = _mm256_xor_si256(flip,
+            _mm256_loadu_si256((const __m256i*)&keys[lo*4]));
+        mask = (unsigned)_mm256_movemask_epi8(or_equal ?
+            _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v));
+        if (or_equal) mask = ~mask;
+        if (mask != full) return lo + __builtin_popcount(mask) / 4;
+      }
+    }
+#endif
+    /* nodes are small, a straight scan beats branching on a bisection */
+    for (; lo < hi; ++lo) {
+      c = compare(self, &keys[lo*self->ksz], key);
+      if (c > 0 || (0 == c && !or_equal)) break;
+    }
+    return lo;
+  }
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    c = self->cmp(&keys[mid*self->ksz], key);
+    if (c < 0 || (0 == c && or_equal)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static struct btree_node* find_leaf(const jx_btree *self, const void *key) {
+  struct btree_node *node = self->root;
+  while (!node->leaf) {
+    node = KIDS(self, node)[rank(self, node, key, true)];
+  }
+  return node;
+}
+
+void* jx_btree_find(const jx_btree *self, const void *key) {
+  struct btree_node *leaf;
+  int i;
+
+  VALID(self);
+  JX_NOT_NULL(key);
+
+  leaf = find_leaf(self, key);
+  i = rank(self, leaf, key, false);
+  if (i < leaf->count && 0 == compare(self, KEY(self, leaf, i), key)) {
+    return VAL(self, leaf, i);
+  }
+  return NULL;
+}
+
+/******************************************************************************/
+
+/* make room for an entry of sz bytes at i, in an array of count entries */
+static void open_gap(unsigned char *base, int i, int count, size_t sz) {
+  memmove(base + (i+1)*sz, base + i*sz, (count - i)*sz);
+}
+
+static void close_gap(unsigned char *base, int i, int count, size_t sz) {
+  memmove(base + i*sz, base + (i+1)*sz, (count - i - 1)*sz);
+}
+
+/* Split the full child i of parent in two. parent has room for one more
+ * separator. */
+static jx_result split_child(jx_btree *self, struct btree_node *parent,
+    int i) {
+  struct btree_node *child = KIDS(self, parent)[i], *right;
+  int keep;
+
+  right = new_node(self, child->leaf);
+  if (NULL == right) return JX_OUT_OF_MEMORY;
+
+  keep = child->count / 2;
+  open_gap(KEY(self, parent, 0), i, parent->count, self->ksz);
+  open_gap((unsigned char*)KIDS(self, parent), i + 1, parent->count + 1,
+      sizeof(right));
+  if (child->leaf) {
+    /* the right half moves, and its first key becomes the separator */
+    right->count = child->count - keep;
+    memcpy(KEY(self, right, 0), KEY(self, child, keep),
+        right->count * self->ksz);
+    memcpy(VAL(self, right, 0), VAL(self, child, keep),
+        right->count * self->vsz);
+    right->next = child->next;
+    child->next = right;
+    memcpy(KEY(self, parent, i), KEY(self, right, 0), self->ksz);
+  } else {
+    /* the middle key moves up, the keys after it move right */
+    right->count = child->count - keep - 1;
+    memcpy(KEY(self, right, 0), KEY(self, child, keep + 1),
+        right->count * self->ksz);
+    memcpy(KIDS(self, right), &KIDS(self, child)[keep + 1],
+        (right->count + 1) * sizeof(right));
+    memcpy(KEY(self, parent, i), KEY(self, child, keep), self->ksz);
+  }
+  child->count = keep;
+  KIDS(self, parent)[i + 1] = right;
+  parent->count++;
+  return JX_OK;
+}
+
+jx_result jx_btree_insert(jx_btree *self, const void *key, const void *value) {
+  struct btree_node *node, *root;
+  int i;
+
+  VALID(self);
+  JX_NOT_NULL(key);
+  JX_NOT_NULL(value);
+
+  /* Full nodes are split on the way down, so there is always room for a
+   * separator coming up. A failed allocation leaves a valid tree. */
+  if (self->root->count == CAPACITY(self, self->root)) {
+    root = new_node(self, false);
+    if (NULL == root) return JX_OUT_OF_MEMORY;
+    KIDS(self, root)[0] = self->root;
+    if (JX_OK != split_child(self, root, 0)) {
+      free(root);
+      return JX_OUT_OF_MEMORY;
+    }
+    self->root = root;
+  }
+
+  node = self->root;
+  while (!node->leaf) {
+    i = rank(self, node, key, true);
+    if (KIDS(self, node)[i]->count == CAPACITY(self, KIDS(self, node)[i])) {
+      JX_TRY(split_child(self, node, i));
+      if (compare(self, key, KEY(self, node, i)) >= 0) i++;
+    }
+    node = KIDS(self, node)[i];
+  }
+
+  i = rank(self, node, key, false);
+  if (i < node->count && 0 == compare(self, KEY(self, node, i), key)) {
+    if (self->destroy) self->destroy(VAL(self, node, i));
+  } else {
+    open_gap(KEY(self, node, 0), i, node->count, self->ksz);
+    open_gap(VAL(self, node, 0), i, node->count, self->vsz);
+    memcpy(KEY(self, node, i), key, self->ksz);
+    node->count++;
+    self->size++;
+  }
+  memcpy(VAL(self, node, i), value, self->vsz);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+/* move the entry (or separator and child) at the end of from to the front
+ * of to. sep is the separator between them in the parent. */
+static void shift_right(jx_btree *self, struct btree_node *from,
+    struct btree_node *to, unsigned char *sep) {
+  open_gap(KEY(self, to, 0), 0, to->count, self->ksz);
+  if (to->leaf) {
+    open_gap(VAL(self, to, 0), 0, to->count, self->vsz);
+    memcpy(KEY(self, to, 0), KEY(self, from, from->count - 1), self->ksz);
+    memcpy(VAL(self, to, 0), VAL(self, from, from->count - 1), self->vsz);
+    memcpy(sep, KEY(self, to, 0), self->ksz);
+  } else {
+    open_gap((unsigned char*)KIDS(self, to), 0, to->count + 1, sizeof(to));
+    memcpy(KEY(self, to, 0), sep, self->ksz);
+    KIDS(self, to)[0] = KIDS(self, from)[from->count];
+    memcpy(sep, KEY(self, from, from->count - 1), self->ksz);
+  }
+  from->count--;
+  to->count++;
+}
+
+/* move the entry at the front of from to the end of to */
+static void shift_left(jx_btree *self, struct btree_node *from,
+    struct btree_node *to, unsigned char *sep) {
+  if (to->leaf) {
+    memcpy(KEY(self, to, to->count), KEY(self, from, 0), self->ksz);
+    memcpy(VAL(self, to, to->count), VAL(self, from, 0), self->vsz);
+    close_gap(KEY(self, from, 0), 0, from->count, self->ksz);
+    close_gap(VAL(self, from, 0), 0, from->count, self->vsz);
+    memcpy(sep, KEY(self, from, 0), self->ksz);
+  } else {
+    memcpy(KEY(self, to, to->count), sep, self->ksz);
+    KIDS(self, to)[to->count + 1] = KIDS(self, from)[0];
+    memcpy(sep, KEY(self, from, 0), self->ksz);
+    close_gap(KEY(self, from, 0), 0, from->count, self->ksz);
+    close_gap((unsigned char*)KIDS(self, from), 0, from->count + 1,
+        sizeof(from));
+  }
+  from->count--;
+  to->count++;
+}
+
+/* merge child i+1 of parent into child i */
+static void merge(jx_btree *self, struct btree_node *parent, int i) {
+  struct btree_node *left = KIDS(self, parent)[i];
+  struct btree_node *right = KIDS(self, parent)[i + 1];
+
+  if (left->leaf) {
+    memcpy(KEY(self, left, left->count), KEY(self, right, 0),
+        right->count * self->ksz);
+    memcpy(VAL(self, left, left->count), VAL(self, right, 0),
+        right->count * self->vsz);
+    left->next = right->next;
+  } else {
+    /* the separator comes down between the two halves */
+    memcpy(KEY(self, left, left->count), KEY(self, parent, i), self->ksz);
+    left->count++;
+    memcpy(KEY(self, left, left->count), KEY(self, right, 0),
+        right->count * self->ksz);
+    memcpy(&KIDS(self, left)[left->count], KIDS(self, right),
+        (right->count + 1) * sizeof(right));
+  }
+  left->count += right->count;
+  free(right);
+
+  close_gap(KEY(self, parent, 0), i, parent->count, self->ksz);
+  close_gap((unsigned char*)KIDS(self, parent), i + 1, parent->count + 1,
+      sizeof(right));
+  parent->count--;
+}
+
+/* child i of parent is one short: borrow from a sibling, or merge */
+static void rebalance(jx_btree *self, struct btree_node *parent, int i) {
+  struct btree_node **kids = KIDS(self, parent);
+
+  if (i > 0 && kids[i-1]->count > MIN_COUNT(self, kids[i-1])) {
+    shift_right(self, kids[i-1], kids[i], KEY(self, parent, i - 1));
+  } else if (i < parent->count &&
+      kids[i+1]->count > MIN_COUNT(self, kids[i+1])) {
+    shift_left(self, kids[i+1], kids[i], KEY(self, parent, i));
+  } else {
+    merge(self, parent, (i > 0 ? i - 1 : i));
+  }
+}
+
+static bool remove_key(jx_btree *self, struct btree_node *node,
+    const void *key, void *out_value) {
+  struct btree_node *child;
+  int i;
+
+  if (node->leaf) {
+    i = rank(self, node, key, false);
+    if (i == node->count || 0 != compare(self, KEY(self, node, i), key)) {
+      return false;
+    }
+    if (out_value) {
+      memcpy(out_value, VAL(self, node, i), self->vsz);
+    } else if (self->destroy) {
+      self->destroy(VAL(self, node, i));
+    }
+    close_gap(KEY(self, node, 0), i, node->count, self->ksz);
+    close_gap(VAL(self, node, 0), i, node->count, self->vsz);
+    node->count--;
+    return true;
+  }
+
+  i = rank(self, node, key, true);
+  child = KIDS(self, node)[i];
+  if (!remove_key(self, child, key, out_value)) return false;
+  if (child->count < MIN_COUNT(self, child)) rebalance(self, node, i);
+  return true;
+}
+
+bool jx_btree_remove(jx_btree *self, const void *key, void *out_value) {
+  struct btree_node *root;
+
+  VALID(self);
+  JX_NOT_NULL(key);
+
+  if (!remove_key(self, self->root, key, out_value)) return false;
+  self->size--;
+  /* the root lost its last separator, its only child takes over */
+  root = self->root;
+  if (!root->leaf && 0 == root->count) {
+    self->root = KIDS(self, root)[0];
+    free(root);
+  }
+  return true;
+}
+
+void jx_btree_clear(jx_btree *self) {
+  struct btree_node *root, *leaf;
+
+  VALID(self);
+  root = self->root;
+  if (root->leaf) {
+    jx_destroy_range(self->destroy, root->count, self->vsz,
+        VAL(self, root, 0));
+    root->count = 0;
+  } else {
+    /* keep the first leaf as the new root, so that this can't fail */
+    while (!KIDS(self, root)[0]->leaf) root = KIDS(self, root)[0];
+    leaf = KIDS(self, root)[0];
+    KIDS(self, root)[0] = NULL;
+    free_node(self, self->root);
+    jx_destroy_range(self->destroy, leaf->count, self->vsz,
+        VAL(self, leaf, 0));
+    leaf->count = 0;
+    leaf->next = NULL;
+    self->root = leaf;
+  }
+  self->size = 0;
+}
+
+/******************************************************************************/
+
+/* Node k of a level gets entries [SHARE(n, nodes, k), SHARE(n, nodes, k+1)):
+ * the n entries dealt out as evenly as possible, so that no node but the
+ * root is below its minimum. */
+#define SHARE(n, nodes, k) ((int)((long)(n) * (k) / (nodes)))
+
+/* Make a node for the level being built. all keeps every node made, so
+ * that a failure can free them. */
+static jx_result add_node(jx_btree *self, bool leaf, jx_vector *all,
+    jx_vector *level, struct btree_node **out_node) {
+  struct btree_node *node;
+
+  JX_TRY(jx_vector_reserve(all, jx_vector_size(all) + 1));
+  JX_TRY(jx_vector_reserve(level, jx_vector_size(level) + 1));
+  node = new_node(self, leaf);
+  if (NULL == node) return JX_OUT_OF_MEMORY;
+  /* reserved above, these won't fail */
+  jx_vector_append(all, 1, NULL);
+  *(struct btree_node**)jx_vector_back(all) = node;
+  jx_vector_append(level, 1, NULL);
+  *(struct btree_node**)jx_vector_back(level) = node;
+  *out_node = node;
+  return JX_OK;
+}
+
+jx_result jx_btree_bulk_load(jx_btree *self, const jx_vector *sorted) {
+  jx_vector all, level, above, lows, tmp;
+  struct btree_node *node, *prev = NULL;
+  const unsigned char *items;
+  jx_result err;
+  int i, k, n, lo, hi, nodes;
+
+  VALID(self);
+  JX_NOT_NULL(sorted);
+  assert(0 == self->size && "Bulk loading needs an empty tree.");
+  assert(sorted->isz == self->ksz + self->vsz &&
+      "Items must be a key followed by a value.");
+
+  n = jx_vector_size(sorted);
+  if (0 == n) return JX_OK;
+  items = jx_vector_data(sorted);
+  for (i = 1; i < n; ++i) {
+    assert(compare(self, &items[(i-1)*sorted->isz], &items[i*sorted->isz]) < 0
+        && "The items must be sorted by key, without duplicates.");
+  }
+
+  /* empty vectors don't allocate, these can't fail */
+  jx_vector_init(&all, sizeof(node), 0, NULL);
+  jx_vector_init(&level, sizeof(node), 0, NULL);
+  jx_vector_init(&above, sizeof(node), 0, NULL);
+  jx_vector_init(&lows, self->ksz, 0, NULL);
+
+  /* the leaves, with the smallest key in each */
+  nodes = (n + self->leaf_cap - 1) / self->leaf_cap;
+  err = jx_vector_append(&lows, nodes, NULL);
+  for (k = 0; JX_OK == err && k < nodes; ++k) {
+    err = add_node(self, true, &all, &level, &node);
+    if (JX_OK != err) break;
+    lo = SHARE(n, nodes, k);
+    hi = SHARE(n, nodes, k + 1);
+    node->count = hi - lo;
+    for (i = lo; i < hi; ++i) {
+      memcpy(KEY(self, node, i - lo), &items[i*sorted->isz], self->ksz);
+      memcpy(VAL(self, node, i - lo), &items[i*sorted->isz + self->ksz],
+          self->vsz);
+    }
+    memcpy(jx_vector_at(&lows, k), KEY(self, node, 0), self->ksz);
+    if (prev) prev->next = node;
+    prev = node;
+  }
+
+  /* then each level above, until there is a single node */
+  while (JX_OK == err && jx_vector_size(&level) > 1) {
+    n = jx_vector_size(&level);
+    nodes = (n + self->inner_cap) / (self->inner_cap + 1);
+    for (k = 0; JX_OK == err && k < nodes; ++k) {
+      err = add_node(self, false, &all, &above, &node);
+      if (JX_OK != err) break;
+      lo = SHARE(n, nodes, k);
+      hi = SHARE(n, nodes, k + 1);
+      node->count = hi - lo - 1;
+      memcpy(KIDS(self, node), jx_vector_at(&level, lo),
+          (hi - lo) * sizeof(node));
+      memcpy(KEY(self, node, 0), jx_vector_at(&lows, lo + 1),
+          node->count * self->ksz);
+      /* the smallest key under a node is the one under its first child.
+       * lo >= k, so the lows can be packed down in place. */
+      memmove(jx_vector_at(&lows, k), jx_vector_at(&lows, lo), self->ksz);
+    }
+    jx_vector_pop_back(&lows, n - nodes);
+    tmp = level;
+    level = above;
+    above = tmp;
+    jx_vector_clear(&above);
+  }
+
+  if (JX_OK == err) {
+    free(self->root);
+    self->root = *(struct btree_node**)jx_vector_front(&level);
+    self->size = jx_vector_size(sorted);
+  } else {
+    for (i = 0; i < jx_vector_size(&all); ++i) {
+      free(*(struct btree_node**)jx_vector_at(&all, i));
+    }
+  }
+  jx_vector_destroy(&all);
+  jx_vector_destroy(&level);
+  jx_vector_destroy(&above);
+  jx_vector_destroy(&lows);
+  return err;
+}
+
+/******************************************************************************/
+
+void jx_btree_seek(const jx_btree *self, const void *lo, const void *hi,
+    jx_btree_cursor *out_cursor) {
+  struct btree_node *leaf;
+
+  VALID(self);
+  JX_NOT_NULL(out_cursor);
+
+  if (lo) {
+    leaf = find_leaf(self, lo);
+    out_cursor->pos = rank(self, leaf, lo, false);
+  } else {
+    for (leaf = self->root; !leaf->leaf; leaf = KIDS(self, leaf)[0]);
+    out_cursor->pos = 0;
+  }
+  out_cursor->tree = self;
+  out_cursor->leaf = leaf;
+  out_cursor->hi = hi;
+}
+
+int jx_btree_next_run(jx_btree_cursor *self, const void **out_keys,
+    void **out_values) {
+  const jx_btree *tree;
+  struct btree_node *leaf;
+  int start, end;
+
+  JX_NOT_NULL(self);
+  tree = self->tree;
+
+  /* skip past the end of a leaf (seek can land there) */
+  while (self->leaf && self->pos >= self->leaf->count) {
+    self->leaf = self->leaf->next;
+    self->pos = 0;
+  }
+  leaf = self->leaf;
+  if (NULL == leaf) return 0;
+
+  start = self->pos;
+  end = leaf->count;
+  if (self->hi && compare(tree, KEY(tree, leaf, end - 1), self->hi) >= 0) {
+    /* hi is in this leaf: this is the last run */
+    end = rank(tree, leaf, self->hi, false);
+    self->leaf = NULL;
+  } else {
+    self->leaf = leaf->next;
+    self->pos = 0;
+  }
+  if (end <= start) return 0;
+
+  JX_SET(out_keys, KEY(tree, leaf, start));
+  JX_SET(out_values, VAL(tree, leaf, start));
+  return end - start;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_btree btree_var, *btree = &btree_var;
+
+/* Check the ordering, fill and depth of every node under node, whose keys
+ * are all in [lo, hi). Returns the depth, or -1. */
+static int check_node(const struct btree_node *node, const void *lo,
+    const void *hi, bool root) {
+  int i, depth = 0, d;
+
+  if (!root && node->count < MIN_COUNT(btree, node)) return -1;
+  if (node->count > CAPACITY(btree, node)) return -1;
+  for (i = 0; i < node->count; ++i) {
+    if (lo && compare(btree, KEY(btree, node, i), lo) < 0) return -1;
+    if (hi && compare(btree, KEY(btree, node, i), hi) >= 0) return -1;
+    if (i > 0 && compare(btree, KEY(btree, node, i-1),
+          KEY(btree, node, i)) >= 0) {
+      return -1;
+    }
+  }
+  if (node->leaf) return 0;
+  for (i = 0; i <= node->count; ++i) {
+    d = check_node(KIDS(btree, node)[i], (i > 0 ? KEY(btree, node, i-1) : lo),
+        (i < node->count ? KEY(btree, node, i) : hi), false);
+    if (d < 0 || (i > 0 && d != depth)) return -1;
+    depth = d;
+  }
+  return depth + 1;
+}
+
+static jx_test check_tree() {
+  JX_EXPECT(check_node(btree->root, NULL, NULL, true) >= 0,
+      "The tree is malformed.");
+  return JX_PASS;
+}
+
+static int destroyed;
+
+static void count_destroy(void *value) {
+  destroyed++;
+}
+
+jx_test btree_insert_remove() {
+  uint64_t key, val, *keys, *vals;
+  jx_btree_cursor cur;
+  jx_test result;
+  int i, n, count, total;
+
+  JX_CATCH(jx_btree_init(btree, sizeof key, sizeof val, NULL, count_destroy));
+  for (i = 0; i < 10000; ++i) {
+    key = (i * 7919ull) % 10000 * 1000003ull;
+    val = ~key;
+    JX_CATCH(jx_btree_insert(btree, &key, &val));
+  }
+  JX_EXPECT(10000 == jx_btree_size(btree), "Incorrect size.");
+  if ((result = check_tree()).file) return result;
+
+  key = 5 * 1000003ull;
+  JX_EXPECT(~key == *(uint64_t*)jx_btree_find(btree, &key), "Find failed.");
+  key = 3;
+  JX_EXPECT(NULL == jx_btree_find(btree, &key), "Found a missing key.");
+
+  /* replacing a value destroys the old one */
+  destroyed = 0;
+  key = 7 * 1000003ull;
+  val = 7;
+  JX_CATCH(jx_btree_insert(btree, &key, &val));
+  JX_EXPECT(1 == destroyed && 10000 == jx_btree_size(btree),
+      "Replacing a value failed.");
+  JX_EXPECT(7 == *(uint64_t*)jx_btree_find(btree, &key), "Replace failed.");
+
+  /* remove all the odd keys, which rebalances all over */
+  for (i = 1; i < 10000; i += 2) {
+    key = i * 1000003ull;
+    JX_EXPECT(jx_btree_remove(btree, &key, &val), "Remove failed.");
+  }
+  key = 1;
+  JX_EXPECT(!jx_btree_remove(btree, &key, NULL), "Removed a missing key.");
+  if ((result = check_tree()).file) return result;
+
+  jx_btree_seek(btree, NULL, NULL, &cur);
+  for (total = 0, n = 0; (count = jx_btree_next_run(&cur,
+          (const void**)&keys, (void**)&vals)); ) {
+    for (i = 0; i < count; ++i, ++n) {
+      JX_EXPECT(keys[i] == 2ull * n * 1000003ull, "Incorrect key order.");
+    }
+    total += count;
+  }
+  JX_EXPECT(jx_btree_size(btree) == total, "Iteration missed keys.");
+
+  destroyed = 0;
+  jx_btree_clear(btree);
+  JX_EXPECT(total == destroyed && jx_btree_isempty(btree), "Clear failed.");
+  jx_btree_destroy(btree);
+  return JX_PASS;
+}
+
+struct name {
+  char text[16];
+};
+
+static int compare_names(const void *a, const void *b) {
+  return strncmp(a, b, sizeof(struct name));
+}
+
+jx_test btree_range() {
+  struct name key, lo, hi;
+  const struct name *keys;
+  jx_btree_cursor cur;
+  int i, count, *vals, seen = 0;
+
+  JX_CATCH(jx_btree_init(btree, sizeof key, sizeof(int), compare_names,
+        NULL));
+  for (i = 0; i < 2000; ++i) {
+    memset(&key, 0, sizeof key);
+    sprintf(key.text, "key%06d", (i * 601) % 2000);
+    JX_CATCH(jx_btree_insert(btree, &key, &i));
+  }
+
+  memset(&lo, 0, sizeof lo);
+  memset(&hi, 0, sizeof hi);
+  strcpy(lo.text, "key000500");
+  strcpy(hi.text, "key0015");
+  jx_btree_seek(btree, &lo, &hi, &cur);
+  while ((count = jx_btree_next_run(&cur, (const void**)&keys,
+          (void**)&vals))) {
+    for (i = 0; i < count; ++i, ++seen) {
+      sprintf(key.text, "key%06d", 500 + seen);
+      JX_EXPECT(0 == strcmp(key.text, keys[i].text), "Incorrect range.");
+      JX_EXPECT((vals[i] * 601) % 2000 == 500 + seen, "Incorrect value.");
+    }
+  }
+  JX_EXPECT(1000 == seen, "Incorrect number of keys in the range.");
+  jx_btree_destroy(btree);
+  return JX_PASS;
+}
+
+jx_test btree_bulk_load() {
+  struct entry { uint32_t key, val; } *e;
+  jx_vector entries;
+  jx_btree_cursor cur;
+  uint32_t key, *keys, *vals;
+  jx_test result;
+  int i, n, count;
+
+  JX_CATCH(jx_vector_init(&entries, sizeof *e, 0, NULL));
+  JX_CATCH(jx_vector_append(&entries, 5000, &e));
+  for (i = 0; i < 5000; ++i) {
+    e[i].key = 3u*i + 0x80000000u;
+    e[i].val = i;
+  }
+
+  JX_CATCH(jx_btree_init(btree, sizeof key, sizeof key, NULL, count_destroy));
+  JX_CATCH(jx_btree_bulk_load(btree, &entries));
+  JX_EXPECT(5000 == jx_btree_size(btree), "Incorrect size.");
+  if ((result = check_tree()).file) return result;
+
+  /* keep going with the usual inserts and removes */
+  for (i = 0; i < 5000; ++i) {
+    key = 3u*i + 1 + 0x80000000u;
+    JX_CATCH(jx_btree_insert(btree, &key, &i));
+    key = 3u*(4999 - i) + 0x80000000u;
+    if (i % 3) {
+      JX_EXPECT(jx_btree_remove(btree, &key, NULL), "Remove failed.");
+    }
+  }
+  if ((result = check_tree()).file) return result;
+
+  key = 0x80000000u;
+  jx_btree_seek(btree, &key, NULL, &cur);
+  for (n = 0; (count = jx_btree_next_run(&cur, (const void**)&keys,
+          (void**)&vals)); n += count) {
+    for (i = 1; i < count; ++i) {
+      JX_EXPECT(keys[i-1] < keys[i], "Incorrect key order.");
+    }
+  }
+  JX_EXPECT(jx_btree_size(btree) == n, "Iteration missed keys.");
+
+  destroyed = 0;
+  jx_btree_destroy(btree);
+  JX_EXPECT(n == destroyed, "Destroy wasn't called on every value.");
+  jx_vector_destroy(&entries);
+  return JX_PASS;
+}
+
+#endif
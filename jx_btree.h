@@ -0,0 +1,71 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_BTREE_H
+#define JX_BTREE_H
+#include "jinks.h"
+
+/* An ordered map from ksz-byte keys to vsz-byte values, as a B+tree. Keys
+ * and values are copied into the nodes, which are a few cache lines each;
+ * leaves are linked, so ranges are read as runs of contiguous entries.
+ *
+ * If cmp is NULL the keys are unsigned integers (uint32_t or uint64_t) in
+ * native byte order; those are searched with SIMD where it is available.
+ * destroy is called on a value when it leaves the tree. Keys are never
+ * destroyed. */
+
+/* Errors: JX_OUT_OF_MEMORY */
+jx_result jx_btree_init(jx_btree *out_self, size_t ksz, size_t vsz,
+    jx_compare cmp, jx_destructor destroy);
+
+void jx_btree_destroy(void *btree);
+
+/******************************************************************************/
+
+bool jx_btree_isempty(const jx_btree *self);
+
+int jx_btree_size(const jx_btree *self);
+
+/* The value stored under key, or NULL. */
+void* jx_btree_find(const jx_btree *self, const void *key);
+
+/******************************************************************************/
+
+/* Store a copy of value under key, replacing (and destroying) any value
+ * already there.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_btree_insert(jx_btree *self, const void *key, const void *value);
+
+/* Take key out of the tree and copy its value to out_value, or destroy the
+ * value if out_value is NULL. Returns false if the key isn't there. */
+bool jx_btree_remove(jx_btree *self, const void *key, void *out_value);
+
+void jx_btree_clear(jx_btree *self);
+
+/* Fill an empty tree from a vector of items that are a key followed by its
+ * value (isz == ksz + vsz), sorted by key with no duplicates. The leaves are
+ * packed nearly full in one pass. The items are copied: the tree then owns
+ * the values.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_btree_bulk_load(jx_btree *self, const jx_vector *sorted);
+
+/******************************************************************************/
+
+/* Ranges are read through a cursor, starting at the first key >= lo and
+ * stopping before the first key >= hi. Either may be NULL for an open end;
+ * hi is not copied, it must stay valid while the cursor is in use. Changing
+ * the tree invalidates its cursors. */
+void jx_btree_seek(const jx_btree *self, const void *lo, const void *hi,
+    jx_btree_cursor *out_cursor);
+
+/* Get the next run of entries that sit together in a leaf: count keys from
+ * out_keys (ksz bytes apart) and their values from out_values (vsz bytes
+ * apart). Returns the count, 0 once the range is done. */
+int jx_btree_next_run(jx_btree_cursor *self, const void **out_keys,
+    void **out_values);
+
+#endif /* end of header guard */
@@ -0,0 +1,461 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_heap.h"
+#include "jx_vector.h"
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(self->cmp); \
+  JX_RANGE(self->arity, 2, 65); \
+  assert(jx_vector_capacity(&self->items) > jx_vector_size(&self->items) && \
+      "Invalid object: no scratch slot past the end of the heap.")
+
+#define DEFAULT_ARITY 4
+
+/* The slot just past the last item always exists (the capacity is kept
+ * above the size) and is used to hold an item while it is sifted. */
+#define ITEM(self, i) \
+  ((unsigned char*)jx_vector_data(&(self)->items) + (size_t)(i) * \
+   (self)->items.isz)
+
+#define ID(self, i) \
+  ((self)->indexed ? ((int*)jx_vector_data(&(self)->ids))[i] : -1)
+
+/* handles that aren't in use hold the next free handle, encoded as -2-next
+ * so that they are negative */
+#define WHERE(self) ((int*)jx_vector_data(&(self)->where))
+
+static jx_result init(jx_heap *out_self, size_t isz, int arity,
+    jx_compare cmp, jx_destructor destroy, bool indexed) {
+  JX_NOT_NULL(out_self);
+  JX_POSITIVE(isz);
+  JX_NOT_NULL(cmp);
+  JX_NOT_NEG(arity);
+
+  out_self->destroy = destroy;
+  out_self->cmp = cmp;
+  out_self->arity = (arity ? arity : DEFAULT_ARITY);
+  out_self->indexed = indexed;
+  out_self->free_handle = -1;
+  /* empty vectors don't allocate, these can't fail */
+  jx_vector_init(&out_self->ids, sizeof(int), 0, NULL);
+  jx_vector_init(&out_self->where, sizeof(int), 0, NULL);
+  return jx_vector_init(&out_self->items, isz, 1, NULL);
+}
+
+jx_result jx_heap_init(jx_heap *out_self, size_t isz, int arity,
+    jx_compare cmp, jx_destructor destroy) {
+  return init(out_self, isz, arity, cmp, destroy, false);
+}
+
+jx_result jx_heap_init_indexed(jx_heap *out_self, size_t isz, int arity,
+    jx_compare cmp, jx_destructor destroy) {
+  return init(out_self, isz, arity, cmp, destroy, true);
+}
+
+void jx_heap_destroy(void *heap) {
+  jx_heap *self = heap;
+  VALID(self);
+
+  jx_destroy_range(self->destroy, jx_vector_size(&self->items),
+      self->items.isz, jx_vector_data(&self->items));
+  jx_vector_destroy(&self->items);
+  jx_vector_destroy(&self->ids);
+  jx_vector_destroy(&self->where);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+bool jx_heap_isempty(const jx_heap *self) {
+  VALID(self);
+  return jx_vector_isempty(&self->items);
+}
+
+int jx_heap_size(const jx_heap *self) {
+  VALID(self);
+  return jx_vector_size(&self->items);
+}
+
+void* jx_heap_peek(const jx_heap *self) {
+  VALID(self);
+  return jx_vector_front(&self->items);
+}
+
+/******************************************************************************/
+
+static void place(jx_heap *self, int pos, const void *item, int id) {
+  memcpy(ITEM(self, pos), item, self->items.isz);
+  if (self->indexed) {
+    ((int*)jx_vector_data(&self->ids))[pos] = id;
+    WHERE(self)[id] = pos;
+  }
+}
+
+/* item (with handle id) goes in the hole at pos, or above it. item must not
+ * be in the heap itself. */
+static void sift_up(jx_heap *self, int pos, const void *item, int id) {
+  int parent;
+
+  while (pos > 0) {
+    parent = (pos - 1) / self->arity;
+    if (self->cmp(item, ITEM(self, parent)) >= 0) break;
+    place(self, pos, ITEM(self, parent), ID(self, parent));
+    pos = parent;
+  }
+  place(self, pos, item, id);
+}
+
+/* item goes in the hole at pos, or below it, in a heap of n items. */
+static void sift_down(jx_heap *self, int pos, const void *item, int id,
+    int n) {
+  int child, best, end;
+
+  for (;;) {
+    child = pos * self->arity + 1;
+    if (child >= n) break;
+    end = (child + self->arity < n ? child + self->arity : n);
+    /* the children are contiguous, the scan stays in a line or two */
+    for (best = child++; child < end; ++child) {
+      if (self->cmp(ITEM(self, child), ITEM(self, best)) < 0) best = child;
+    }
+    if (self->cmp(ITEM(self, best), item) >= 0) break;
+    place(self, pos, ITEM(self, best), ID(self, best));
+    pos = best;
+  }
+  place(self, pos, item, id);
+}
+
+static void heapify(jx_heap *self) {
+  int pos, n = jx_vector_size(&self->items);
+  unsigned char *scratch = ITEM(self, n);
+
+  for (pos = (n - 2) / self->arity; n > 1 && pos >= 0; --pos) {
+    memcpy(scratch, ITEM(self, pos), self->items.isz);
+    sift_down(self, pos, scratch, ID(self, pos), n);
+  }
+}
+
+jx_result jx_heap_init_from(jx_heap *out_self, jx_vector *vector, int arity,
+    jx_compare cmp) {
+  JX_NOT_NULL(vector);
+
+  /* make the scratch slot first, so that vector is untouched on failure */
+  JX_TRY(jx_vector_reserve(vector, jx_vector_size(vector) + 1));
+  JX_TRY(init(out_self, vector->isz, arity, cmp, vector->destroy, false));
+  jx_vector_destroy(&out_self->items);
+  out_self->items = *vector;
+  out_self->items.destroy = NULL;
+  /* an empty vector doesn't allocate, this can't fail */
+  jx_vector_init(vector, out_self->items.isz, 0, out_self->destroy);
+
+  heapify(out_self);
+  VALID(out_self);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+/* make room for num more items, so that pushing them can't fail. */
+static jx_result reserve(jx_heap *self, int num) {
+  int n = jx_vector_size(&self->items);
+
+  JX_TRY(jx_vector_reserve(&self->items, n + num + 1));
+  if (self->indexed) {
+    JX_TRY(jx_vector_reserve(&self->ids, n + num));
+    JX_TRY(jx_vector_reserve(&self->where, jx_vector_size(&self->where) +
+          num));
+  }
+  return JX_OK;
+}
+
+static int new_handle(jx_heap *self) {
+  int h = self->free_handle;
+
+  if (!self->indexed) return -1;
+  if (h >= 0) {
+    self->free_handle = -2 - WHERE(self)[h];
+  } else {
+    /* reserved beforehand, these won't fail */
+    jx_vector_append(&self->where, 1, NULL);
+    h = jx_vector_size(&self->where) - 1;
+  }
+  jx_vector_append(&self->ids, 1, NULL);
+  return h;
+}
+
+static void free_handle(jx_heap *self, int h) {
+  if (!self->indexed) return;
+  WHERE(self)[h] = -2 - self->free_handle;
+  self->free_handle = h;
+  jx_vector_pop_back(&self->ids, 1);
+}
+
+static int push_one(jx_heap *self, const void *item) {
+  int n = jx_vector_size(&self->items), h = new_handle(self);
+
+  jx_vector_append(&self->items, 1, NULL);
+  /* go through the scratch slot, item may not stay put while sifting */
+  memcpy(ITEM(self, n + 1), item, self->items.isz);
+  sift_up(self, n, ITEM(self, n + 1), h);
+  return h;
+}
+
+jx_result jx_heap_push(jx_heap *self, const void *item, int *out_handle) {
+  int h;
+
+  VALID(self);
+  JX_NOT_NULL(item);
+
+  JX_TRY(reserve(self, 1));
+  h = push_one(self, item);
+  if (out_handle) *out_handle = h;
+  return JX_OK;
+}
+
+jx_result jx_heap_push_many(jx_heap *self, const void *items, int num,
+    int *out_handles) {
+  const unsigned char *src = items;
+  int i, h, n;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+  JX_ARRAY_SZ(num, items);
+
+  JX_TRY(reserve(self, num));
+  n = jx_vector_size(&self->items);
+  if (num <= n) {
+    for (i = 0; i < num; ++i, src += self->items.isz) {
+      h = push_one(self, src);
+      if (out_handles) out_handles[i] = h;
+    }
+    return JX_OK;
+  }
+
+  /* more new items than old ones: append them all and rebuild */
+  jx_vector_append(&self->items, num, NULL);
+  for (i = 0; i < num; ++i, src += self->items.isz) {
+    h = new_handle(self);
+    place(self, n + i, src, h);
+    if (out_handles) out_handles[i] = h;
+  }
+  heapify(self);
+  return JX_OK;
+}
+
+/* take the item at pos out of the heap and fill the hole with the last. */
+static void take(jx_heap *self, int pos, void *out_item) {
+  int last = jx_vector_size(&self->items) - 1, id = ID(self, last);
+
+  if (out_item) {
+    memcpy(out_item, ITEM(self, pos), self->items.isz);
+  } else if (self->destroy) {
+    self->destroy(ITEM(self, pos));
+  }
+  free_handle(self, ID(self, pos));
+  jx_vector_pop_back(&self->items, 1);
+  if (pos == last) return;
+
+  /* the last item now sits in the slot past the end, which sifting leaves
+   * alone */
+  if (pos > 0 && self->cmp(ITEM(self, last), ITEM(self, (pos - 1) /
+          self->arity)) < 0) {
+    sift_up(self, pos, ITEM(self, last), id);
+  } else {
+    sift_down(self, pos, ITEM(self, last), id, last);
+  }
+}
+
+void jx_heap_pop(jx_heap *self, void *out_item) {
+  VALID(self);
+  JX_POSITIVE(jx_vector_size(&self->items));
+  take(self, 0, out_item);
+}
+
+/******************************************************************************/
+
+static int position(const jx_heap *self, int handle) {
+  assert(self->indexed && "Handles need an indexed heap.");
+  JX_RANGE(handle, 0, jx_vector_size(&self->where));
+  assert(WHERE(self)[handle] >= 0 && "The handle isn't in the heap.");
+  return WHERE(self)[handle];
+}
+
+void* jx_heap_get(const jx_heap *self, int handle) {
+  VALID(self);
+  return ITEM(self, position(self, handle));
+}
+
+void jx_heap_update(jx_heap *self, int handle, const void *item) {
+  int pos, n;
+  unsigned char *scratch;
+
+  VALID(self);
+  JX_NOT_NULL(item);
+
+  pos = position(self, handle);
+  n = jx_vector_size(&self->items);
+  scratch = ITEM(self, n);
+  memcpy(scratch, item, self->items.isz);
+  if (self->destroy) self->destroy(ITEM(self, pos));
+
+  if (pos > 0 && self->cmp(scratch, ITEM(self, (pos - 1) / self->arity)) < 0) {
+    sift_up(self, pos, scratch, handle);
+  } else {
+    sift_down(self, pos, scratch, handle, n);
+  }
+}
+
+void jx_heap_remove(jx_heap *self, int handle, void *out_item) {
+  VALID(self);
+  take(self, position(self, handle), out_item);
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_heap heap_var, *heap = &heap_var;
+
+static int compare_ints(const void *a, const void *b) {
+  int x = *(const int*)a, y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+static int destroyed;
+
+static void count_destroy(void *item) {
+  destroyed++;
+}
+
+/* pop everything, checking the order */
+static jx_test drain(int expected) {
+  int last = -1, val, n = 0;
+
+  while (!jx_heap_isempty(heap)) {
+    JX_EXPECT(*(int*)jx_heap_peek(heap) >= last, "Peek isn't the smallest.");
+    jx_heap_pop(heap, &val);
+    JX_EXPECT(val >= last, "Items came out of order.");
+    last = val;
+    n++;
+  }
+  JX_EXPECT(expected == n, "Incorrect number of items.");
+  return JX_PASS;
+}
+
+jx_test heap_order() {
+  static const int arities[] = { 0, 2, 3, 8 };
+  jx_test result;
+  int a, i, val;
+
+  for (a = 0; a < 4; ++a) {
+    JX_CATCH(jx_heap_init(heap, sizeof(int), arities[a], compare_ints,
+          count_destroy));
+    for (i = 0; i < 1000; ++i) {
+      val = (i * 7919) % 1009;
+      JX_CATCH(jx_heap_push(heap, &val, NULL));
+    }
+    JX_EXPECT(1000 == jx_heap_size(heap), "Incorrect heap size.");
+
+    destroyed = 0;
+    jx_heap_pop(heap, NULL);
+    jx_heap_pop(heap, NULL);
+    JX_EXPECT(2 == destroyed, "Pop didn't destroy the items.");
+    result = drain(998);
+    if (result.file) return result;
+    jx_heap_destroy(heap);
+  }
+  return JX_PASS;
+}
+
+jx_test heap_bulk() {
+  jx_vector vals;
+  int i, *v, more[6000];
+  jx_test result;
+
+  JX_CATCH(jx_vector_init(&vals, sizeof(int), 0, NULL));
+  JX_CATCH(jx_vector_append(&vals, 5000, &v));
+  for (i = 0; i < 5000; ++i) {
+    v[i] = 5000 - i;
+  }
+  JX_CATCH(jx_heap_init_from(heap, &vals, 0, compare_ints));
+  JX_EXPECT(jx_vector_isempty(&vals), "The vector should be left empty.");
+  JX_EXPECT(1 == *(int*)jx_heap_peek(heap), "Heapify missed the smallest.");
+
+  for (i = 0; i < 6000; ++i) {
+    more[i] = (i * 31) % 6007;
+  }
+  /* more items than the heap holds, then only a few */
+  JX_CATCH(jx_heap_push_many(heap, more, 6000, NULL));
+  JX_CATCH(jx_heap_push_many(heap, more, 10, NULL));
+  result = drain(11010);
+
+  jx_vector_destroy(&vals);
+  jx_heap_destroy(heap);
+  return result;
+}
+
+struct timer {
+  double when;
+  int id;
+};
+
+static int compare_timers(const void *a, const void *b) {
+  const struct timer *x = a, *y = b;
+  return (x->when > y->when) - (x->when < y->when);
+}
+
+jx_test heap_timers() {
+  struct timer t, last;
+  int i, handles[200], bulk[3];
+  bool seen[200];
+
+  JX_CATCH(jx_heap_init_indexed(heap, sizeof t, 0, compare_timers, NULL));
+  for (i = 0; i < 200; ++i) {
+    t.when = 1000 + (i * 37) % 200;
+    t.id = i;
+    JX_CATCH(jx_heap_push(heap, &t, &handles[i]));
+  }
+
+  /* reschedule every 10th timer to the front, and every 10th + 5 to the
+   * back; cancel every 10th + 7 */
+  for (i = 0; i < 200; i += 10) {
+    t.when = i;
+    t.id = i;
+    jx_heap_update(heap, handles[i], &t);
+    t.when = 5000 + i;
+    t.id = i + 5;
+    jx_heap_update(heap, handles[i + 5], &t);
+    jx_heap_remove(heap, handles[i + 7], &t);
+    JX_EXPECT(i + 7 == t.id, "Removed the wrong timer.");
+  }
+  JX_EXPECT(180 == jx_heap_size(heap), "Incorrect number of timers.");
+  JX_EXPECT(190 == ((struct timer*)jx_heap_get(heap, handles[190]))->id,
+      "A handle points at the wrong timer.");
+
+  /* the handles of cancelled timers are reused */
+  JX_CATCH(jx_heap_push_many(heap, &t, 1, bulk));
+  JX_EXPECT(handles[197] == bulk[0], "Handles aren't reused.");
+  jx_heap_remove(heap, bulk[0], NULL);
+
+  memset(seen, 0, sizeof seen);
+  last.when = -1;
+  for (i = 0; !jx_heap_isempty(heap); ++i) {
+    jx_heap_pop(heap, &t);
+    JX_EXPECT(t.when >= last.when, "Timers came out of order.");
+    JX_EXPECT(i >= 20 || t.when == 10*i, "Rescheduled timers aren't first.");
+    JX_EXPECT(i < 160 || t.when >= 5000, "Postponed timers aren't last.");
+    JX_EXPECT(!seen[t.id] && t.id % 10 != 7, "Unexpected timer.");
+    seen[t.id] = true;
+    last = t;
+  }
+  JX_EXPECT(180 == i, "Timers went missing.");
+
+  jx_heap_destroy(heap);
+  return JX_PASS;
+}
+
+#endif
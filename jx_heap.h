@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_HEAP_H
+#define JX_HEAP_H
+#include "jinks.h"
+
+/* A priority queue of isz-byte items, stored in a jx_vector as a d-ary heap.
+ * The top is the smallest item according to cmp. Each node has arity
+ * children (4 by default): a wider heap is shallower, and the children of a
+ * node sit next to each other, usually in the same cache line or two. */
+
+/* An arity of 0 picks the default.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_heap_init(jx_heap *out_self, size_t isz, int arity,
+    jx_compare cmp, jx_destructor destroy);
+
+/* Same as jx_heap_init, but every item pushed gets a handle that can later
+ * be used to update or remove it (like cancelling or rescheduling a timer).
+ * Handles are small integers, reused once their item leaves the heap.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_heap_init_indexed(jx_heap *out_self, size_t isz, int arity,
+    jx_compare cmp, jx_destructor destroy);
+
+/* Build a heap from the items of vector in O(n). The heap takes over the
+ * vector's buffer and its destructor; vector is left empty.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_heap_init_from(jx_heap *out_self, jx_vector *vector, int arity,
+    jx_compare cmp);
+
+void jx_heap_destroy(void *heap);
+
+/******************************************************************************/
+
+bool jx_heap_isempty(const jx_heap *self);
+
+int jx_heap_size(const jx_heap *self);
+
+void* jx_heap_peek(const jx_heap *self);
+
+/******************************************************************************/
+
+/* Copy item into the heap. An indexed heap reports the item's handle in
+ * out_handle, which may be NULL.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_heap_push(jx_heap *self, const void *item, int *out_handle);
+
+/* Push num items at once. Adding more items than the heap holds rebuilds it
+ * in one O(n) pass instead of pushing them one by one. out_handles (for an
+ * indexed heap) may be NULL.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_heap_push_many(jx_heap *self, const void *items, int num,
+    int *out_handles);
+
+/* Remove the top item and copy it to out_item. If out_item is NULL the item
+ * is destroyed instead. */
+void jx_heap_pop(jx_heap *self, void *out_item);
+
+/******************************************************************************/
+
+/* For indexed heaps. */
+
+void* jx_heap_get(const jx_heap *self, int handle);
+
+/* Replace an item and move it to its new place: the decrease-key operation,
+ * though the new item may compare either way. */
+void jx_heap_update(jx_heap *self, int handle, const void *item);
+
+/* Take an item out of the middle of the heap, like jx_heap_pop. */
+void jx_heap_remove(jx_heap *self, int handle, void *out_item);
+
+#endif /* end of header guard */
@@ -0,0 +1,381 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_intern.h"
+#include "jx_pointer.h"
+#include "jx_vector.h"
+#include <pthread.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(self->data)
+
+#define MIN_SLOTS 16
+
+/* Written just past each payload (rounded up to keep it aligned), so that a
+ * reference being destroyed can find its way back to its slot. */
+struct entry {
+  struct intern_data *table;
+  uint64_t hash;
+  size_t sz;
+};
+
+#define ENTRY_AT(sz) (((sz) + 7) & ~(size_t)7)
+
+/* Open addressing with linear probing. A slot is empty when data is NULL. */
+struct slot {
+  uint64_t hash;
+  struct pointer_data *data;
+};
+
+struct intern_data {
+  pthread_mutex_t lock;
+  jx_vector slots;
+  int size;
+  long lookups, hits;
+  size_t saved;
+};
+
+/* Eight bytes per multiply, then a final mix so that the low bits, which
+ * pick the slot, depend on all of the input. */
+static uint64_t hash_bytes(const void *bytes, size_t sz) {
+  const unsigned char *p = bytes;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ sz, w;
+
+  for (; sz >= 8; p += 8, sz -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 31;
+  }
+  if (sz > 0) {
+    w = 0;
+    memcpy(&w, p, sz);
+    h = (h ^ w) * 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 31;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/******************************************************************************/
+
+static jx_result make_slots(jx_vector *out_slots, int count) {
+  struct slot *s;
+
+  JX_TRY(jx_vector_init(out_slots, sizeof *s, count, NULL));
+  /* reserved above, this can't fail */
+  jx_vector_append(out_slots, count, &s);
+  memset(s, 0, count * sizeof *s);
+  return JX_OK;
+}
+
+/* The first of slots that is either empty or holds the payload. */
+static struct slot* probe(const jx_vector *slots, uint64_t hash,
+    const void *bytes, size_t sz) {
+  struct slot *s = jx_vector_data(slots);
+  int mask = jx_vector_size(slots) - 1, i;
+  struct entry *e;
+
+  for (i = hash & mask; s[i].data; i = (i + 1) & mask) {
+    if (s[i].hash != hash) continue;
+    e = s[i].data->owner;
+    if (e->sz == sz && 0 == memcmp(s[i].data->item, bytes, sz)) break;
+  }
+  return &s[i];
+}
+
+/* Double the slots, or make the first ones. The table only changes once the
+ * new slots are allocated, so on error it is left as it was. */
+static jx_result grow(struct intern_data *t) {
+  jx_vector bigger;
+  struct slot *s, *end;
+  struct entry *e;
+  int n = jx_vector_size(&t->slots);
+
+  JX_TRY(make_slots(&bigger, n ? 2 * n : MIN_SLOTS));
+  s = jx_vector_data(&t->slots);
+  for (end = s + n; s != end; ++s) {
+    if (NULL == s->data) continue;
+    e = s->data->owner;
+    *probe(&bigger, s->hash, s->data->item, e->sz) = *s;
+  }
+  jx_vector_destroy(&t->slots);
+  t->slots = bigger;
+  return JX_OK;
+}
+
+/* Take data out of its slot, shifting back any entries after it that would
+ * otherwise no longer be reachable from their home slot. */
+static void unlink_slot(struct intern_data *t, const struct pointer_data *data,
+    uint64_t hash) {
+  struct slot *slots = jx_vector_data(&t->slots);
+  int mask = jx_vector_size(&t->slots) - 1, i, j, home;
+
+  for (i = hash & mask; slots[i].data != data; i = (i + 1) & mask);
+  for (j = (i + 1) & mask; slots[j].data; j = (j + 1) & mask) {
+    home = slots[j].hash & mask;
+    /* move it back unless its home lies cyclically in (i, j] */
+    if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i].data = NULL;
+  --t->size;
+}
+
+/* The pointer_data release hook. References other than the last are
+ * dropped without the lock. Dropping the last one and unlinking the entry
+ * happen under the table's lock, so a lookup can't revive an entry that is
+ * being destroyed; a lookup may also have cloned it after the count was
+ * read, so the count is checked again there. */
+static int release(struct pointer_data *data) {
+  struct entry *e;
+  struct intern_data *t;
+  int refs = __atomic_load_n(&data->refs, __ATOMIC_RELAXED);
+
+  while (refs > 1) {
+    if (__atomic_compare_exchange_n(&data->refs, &refs, refs - 1, true,
+          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      return refs - 1;
+    }
+  }
+
+  e = data->owner;
+  t = e->table;
+  pthread_mutex_lock(&t->lock);
+  refs = __atomic_sub_fetch(&data->refs, 1, __ATOMIC_ACQ_REL);
+  if (refs <= 0) unlink_slot(t, data, e->hash);
+  pthread_mutex_unlock(&t->lock);
+  return refs;
+}
+
+/******************************************************************************/
+
+jx_result jx_intern_init(jx_intern *out_self) {
+  JX_NOT_NULL(out_self);
+
+  out_self->data = calloc(1, sizeof *out_self->data);
+  if (NULL == out_self->data) return JX_OUT_OF_MEMORY;
+  pthread_mutex_init(&out_self->data->lock, NULL);
+  /* empty vectors don't allocate, this can't fail */
+  jx_vector_init(&out_self->data->slots, sizeof(struct slot), 0, NULL);
+  VALID(out_self);
+  return JX_OK;
+}
+
+void jx_intern_destroy(void *intern) {
+  jx_intern *self = intern;
+  struct slot *s, *end;
+  VALID(self);
+
+  /* the payloads outlive the table as plain references */
+  s = jx_vector_data(&self->data->slots);
+  for (end = s + jx_vector_size(&self->data->slots); s != end; ++s) {
+    if (NULL == s->data) continue;
+    s->data->release = NULL;
+    s->data->owner = NULL;
+  }
+  jx_vector_destroy(&self->data->slots);
+  pthread_mutex_destroy(&self->data->lock);
+  free(self->data);
+  self->data = NULL;
+}
+
+/******************************************************************************/
+
+/* The rest of jx_intern_get, under the lock. */
+static jx_result lookup(struct intern_data *t, uint64_t hash,
+    const void *bytes, size_t sz, jx_pointer *out_ptr) {
+  struct slot *s;
+  struct entry *e;
+  jx_pointer found;
+
+  if (!jx_vector_isempty(&t->slots)) {
+    s = probe(&t->slots, hash, bytes, sz);
+    if (s->data) {
+      ++t->lookups;
+      ++t->hits;
+      t->saved += sz;
+      found.data = s->data;
+      jx_pointer_clone(&found, out_ptr);
+      return JX_OK;
+    }
+  }
+
+  /* a miss: only now make room for the new entry, and find its slot again */
+  if (2 * (t->size + 1) > jx_vector_size(&t->slots)) {
+    JX_TRY(grow(t));
+  }
+  s = probe(&t->slots, hash, bytes, sz);
+
+  /* a new payload, with its entry behind it */
+  JX_TRY(jx_pointer_init(out_ptr, ENTRY_AT(sz) + sizeof *e, NULL));
+  memcpy(jx_pointer_get(out_ptr), bytes, sz);
+  e = (struct entry*)((unsigned char*)jx_pointer_get(out_ptr) + ENTRY_AT(sz));
+  e->table = t;
+  e->hash = hash;
+  e->sz = sz;
+  out_ptr->data->owner = e;
+  out_ptr->data->release = release;
+  s->hash = hash;
+  s->data = out_ptr->data;
+  ++t->size;
+  ++t->lookups;
+  return JX_OK;
+}
+
+jx_result jx_intern_get(jx_intern *self, const void *bytes, size_t sz,
+    jx_pointer *out_ptr) {
+  uint64_t hash;
+  jx_result result;
+
+  VALID(self);
+  JX_NOT_NULL(bytes);
+  JX_NOT_NULL(out_ptr);
+
+  /* hash before taking the lock */
+  hash = hash_bytes(bytes, sz);
+  pthread_mutex_lock(&self->data->lock);
+  result = lookup(self->data, hash, bytes, sz, out_ptr);
+  pthread_mutex_unlock(&self->data->lock);
+  return result;
+}
+
+/******************************************************************************/
+
+int jx_intern_size(const jx_intern *self) {
+  int size;
+  VALID(self);
+
+  pthread_mutex_lock(&self->data->lock);
+  size = self->data->size;
+  pthread_mutex_unlock(&self->data->lock);
+  return size;
+}
+
+double jx_intern_hit_rate(const jx_intern *self) {
+  double rate;
+  VALID(self);
+
+  pthread_mutex_lock(&self->data->lock);
+  rate = self->data->lookups ?
+    (double)self->data->hits / self->data->lookups : 0;
+  pthread_mutex_unlock(&self->data->lock);
+  return rate;
+}
+
+size_t jx_intern_bytes_saved(const jx_intern *self) {
+  size_t saved;
+  VALID(self);
+
+  pthread_mutex_lock(&self->data->lock);
+  saved = self->data->saved;
+  pthread_mutex_unlock(&self->data->lock);
+  return saved;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+jx_test intern_share() {
+  static const char *agents[] = {
+    "Mozilla/5.0 (X11; Linux x86_64)",
+    "curl/8.4.0",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 14_1)",
+  };
+  jx_intern table;
+  jx_pointer refs[300], again;
+  size_t saved = 0;
+  int i;
+
+  JX_CATCH(jx_intern_init(&table));
+  for (i = 0; i < 300; ++i) {
+    JX_CATCH(jx_intern_get(&table, agents[i % 3], strlen(agents[i % 3]) + 1,
+          &refs[i]));
+    if (i >= 3) saved += strlen(agents[i % 3]) + 1;
+  }
+  JX_EXPECT(3 == jx_intern_size(&table), "Each payload should be kept once.");
+  for (i = 3; i < 300; ++i) {
+    JX_EXPECT(jx_pointer_get(&refs[i]) == jx_pointer_get(&refs[i % 3]),
+        "Identical payloads should share a copy.");
+  }
+  JX_EXPECT(0 == strcmp(agents[1], jx_pointer_get(&refs[4])),
+      "The payload was corrupted.");
+  JX_EXPECT(297.0 / 300 == jx_intern_hit_rate(&table), "Wrong hit rate.");
+  JX_EXPECT(saved == jx_intern_bytes_saved(&table), "Wrong bytes saved.");
+
+  /* the entry goes when its last reference does, clones included */
+  jx_pointer_clone(&refs[1], &again);
+  for (i = 1; i < 300; i += 3) {
+    jx_pointer_destroy(&refs[i]);
+  }
+  JX_EXPECT(3 == jx_intern_size(&table), "A clone should keep its entry.");
+  jx_pointer_destroy(&again);
+  JX_EXPECT(2 == jx_intern_size(&table), "The dead entry wasn't dropped.");
+
+  /* and interning it again makes a new copy */
+  JX_CATCH(jx_intern_get(&table, agents[1], strlen(agents[1]) + 1, &again));
+  JX_EXPECT(3 == jx_intern_size(&table), "The payload wasn't interned again.");
+
+  /* references outlive the table */
+  jx_intern_destroy(&table);
+  JX_EXPECT(0 == strcmp(agents[2], jx_pointer_get(&refs[2])),
+      "Destroying the table lost a payload.");
+  jx_pointer_destroy(&again);
+  for (i = 0; i < 300; ++i) {
+    if (1 != i % 3) jx_pointer_destroy(&refs[i]);
+  }
+  return JX_PASS;
+}
+
+static jx_intern shared_table;
+
+/* Intern and drop a small set of keys over and over, so that entries keep
+ * dying and coming back while other threads look them up. */
+static void* churn(void *arg) {
+  jx_pointer held[8];
+  int i, j, key, *bad = arg;
+
+  for (i = 0; i < 20000; ++i) {
+    key = (i * 7) % 64;
+    if (JX_OK != jx_intern_get(&shared_table, &key, sizeof key,
+          &held[i % 8])) {
+      ++*bad;
+      for (j = 0; j < i % 8; ++j) jx_pointer_destroy(&held[j]);
+      break;
+    }
+    if (*(int*)jx_pointer_get(&held[i % 8]) != key) ++*bad;
+    if (i % 8 == 7) {
+      for (j = 0; j < 8; ++j) jx_pointer_destroy(&held[j]);
+    }
+  }
+  return NULL;
+}
+
+jx_test intern_threads() {
+  pthread_t threads[4];
+  int bad[4] = {0}, i, started;
+
+  JX_CATCH(jx_intern_init(&shared_table));
+  for (started = 0; started < 4; ++started) {
+    if (0 != pthread_create(&threads[started], NULL, churn, &bad[started])) {
+      break;
+    }
+  }
+  for (i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+    JX_EXPECT(0 == bad[i], "A thread got the wrong payload.");
+  }
+  JX_EXPECT(0 == jx_intern_size(&shared_table),
+      "Every entry should be gone with its references.");
+  jx_intern_destroy(&shared_table);
+  return JX_PASS;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_INTERN_H
+#define JX_INTERN_H
+#include "jinks.h"
+
+/* Shares one copy of each distinct payload (user agents, tags and other
+ * blobs that many records repeat). Interning bytes that are already in the
+ * table hands out another reference to the copy there instead of
+ * allocating, and the entry leaves the table when its last reference is
+ * destroyed. Threads can intern and destroy references at the same time. */
+
+/* Errors: JX_OUT_OF_MEMORY */
+jx_result jx_intern_init(jx_intern *out_self);
+
+/* References still alive keep their payload but are no longer tracked.
+ * Must not race with other calls on the table or with destroying its
+ * references. */
+void jx_intern_destroy(void *intern);
+
+/******************************************************************************/
+
+/* Get a reference to the table's copy of the sz bytes at bytes, making the
+ * copy if there isn't one yet. The payload must not be changed.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_intern_get(jx_intern *self, const void *bytes, size_t sz,
+    jx_pointer *out_ptr);
+
+/******************************************************************************/
+
+/* number of distinct payloads alive */
+int jx_intern_size(const jx_intern *self);
+
+/* fraction of successful jx_intern_get calls that found their payload in
+ * the table */
+double jx_intern_hit_rate(const jx_intern *self);
+
+/* bytes that those calls didn't have to allocate */
+size_t jx_intern_bytes_saved(const jx_intern *self);
+
+#endif /* end of header guard */
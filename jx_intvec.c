@@ -0,0 +1,502 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_intvec.h"
+#include "jx_vector.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86 1
+#include <immintrin.h>
+#endif
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NEG(self->size); \
+  assert(self->size == jx_vector_size(&self->blocks) * JX_INTVEC_BLOCK + \
+      jx_vector_size(&self->tail) && "Invalid object: incorrect size.")
+
+/* Value j of a block is number j/LANES in lane j%LANES. Each lane is its
+ * own stream of bits, and the lanes take turns a word at a time: word w of
+ * lane l is word LANES*w + l of the block. */
+#define LANES 4
+#define PER_LANE (JX_INTVEC_BLOCK / LANES)
+
+struct block {
+  /* the smallest value, or the first of a sorted block */
+  uint64_t base;
+  /* where the block's words start, and the width of each value */
+  uint32_t word, bits;
+};
+
+/* words in a block of values of the given width */
+#define BLOCK_WORDS(bits) (LANES * (((bits) * PER_LANE + 63) / 64))
+
+#define MASK(bits) ((bits) == 64 ? ~(uint64_t)0 : ((uint64_t)1 << (bits)) - 1)
+
+static int width(uint64_t x) {
+  return (x ? 64 - __builtin_clzll(x) : 0);
+}
+
+static uint64_t read_uint(const unsigned char *item, size_t isz) {
+  switch (isz) {
+    case 1: return *item;
+    case 2: return *(const uint16_t*)item;
+    case 4: return *(const uint32_t*)item;
+    default: return *(const uint64_t*)item;
+  }
+}
+
+static void write_uint(unsigned char *item, size_t isz, uint64_t val) {
+  assert(val <= MASK(8 * isz) && "The value doesn't fit the item size.");
+  switch (isz) {
+    case 1: *item = (unsigned char)val; break;
+    case 2: *(uint16_t*)item = (uint16_t)val; break;
+    case 4: *(uint32_t*)item = (uint32_t)val; break;
+    default: *(uint64_t*)item = val; break;
+  }
+}
+
+void jx_intvec_init(jx_intvec *out_self, bool sorted) {
+  JX_NOT_NULL(out_self);
+
+  out_self->sorted = sorted;
+  out_self->size = 0;
+  out_self->last = 0;
+  /* empty vectors don't allocate, these can't fail */
+  jx_vector_init(&out_self->blocks, sizeof(struct block), 0, NULL);
+  jx_vector_init(&out_self->words, sizeof(uint64_t), 0, NULL);
+  jx_vector_init(&out_self->tail, sizeof(uint64_t), 0, NULL);
+}
+
+void jx_intvec_destroy(void *intvec) {
+  jx_intvec *self = intvec;
+  VALID(self);
+
+  jx_vector_destroy(&self->blocks);
+  jx_vector_destroy(&self->words);
+  jx_vector_destroy(&self->tail);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+/* Pack a full block of values onto the end of the vector. */
+static jx_result pack(jx_intvec *self, const uint64_t *vals) {
+  uint64_t offsets[JX_INTVEC_BLOCK], base = vals[0], most = 0, *words = NULL;
+  struct block *b;
+  int j, l, t, pos, nwords;
+
+  if (self->sorted) {
+    /* each value is stored as the difference from the one a lane before,
+     * so that decoding is a running sum in each lane */
+    for (j = 0; j < JX_INTVEC_BLOCK; ++j) {
+      offsets[j] = vals[j] - vals[j < LANES ? 0 : j - LANES];
+      most |= offsets[j];
+    }
+  } else {
+    for (j = 1; j < JX_INTVEC_BLOCK; ++j) {
+      if (vals[j] < base) base = vals[j];
+    }
+    for (j = 0; j < JX_INTVEC_BLOCK; ++j) {
+      offsets[j] = vals[j] - base;
+      most |= offsets[j];
+    }
+  }
+
+  JX_TRY(jx_vector_reserve(&self->blocks, jx_vector_size(&self->blocks) + 1));
+  nwords = BLOCK_WORDS(width(most));
+  if (nwords > 0) {
+    JX_TRY(jx_vector_append(&self->words, nwords, &words));
+    memset(words, 0, nwords * sizeof *words);
+  }
+
+  /* reserved above, this won't fail */
+  jx_vector_append(&self->blocks, 1, &b);
+  b->base = base;
+  b->word = jx_vector_size(&self->words) - nwords;
+  b->bits = width(most);
+
+  for (j = 0; nwords && j < JX_INTVEC_BLOCK; ++j) {
+    l = j % LANES;
+    t = j / LANES;
+    pos = t * b->bits;
+    words[LANES*(pos/64) + l] |= offsets[j] << (pos % 64);
+    if (pos % 64 + b->bits > 64) {
+      words[LANES*(pos/64 + 1) + l] |= offsets[j] >> (64 - pos % 64);
+    }
+  }
+  return JX_OK;
+}
+
+/* The AVX2 decode is built whatever the flags, and used when the CPU
+ * supports it, which is checked once when the program is loaded. */
+static bool has_avx2;
+
+__attribute__((constructor)) static void detect_avx2() {
+#ifdef X86
+  __builtin_cpu_init();
+  has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static void unpack_plain(const struct block *b, const uint64_t *words,
+    bool sorted, uint64_t *out) {
+  const uint64_t mask = MASK(b->bits);
+  int j, l, t, pos, off;
+
+  for (t = 0; t < PER_LANE; ++t) {
+    pos = t * b->bits;
+    off = pos % 64;
+    for (l = 0; l < LANES; ++l) {
+      uint64_t v = words[LANES*(pos/64) + l] >> off;
+      if (off + b->bits > 64) {
+        v |= words[LANES*(pos/64 + 1) + l] << (64 - off);
+      }
+      v &= mask;
+      j = LANES*t + l;
+      out[j] = (sorted && j >= LANES ? out[j - LANES] : b->base) + v;
+    }
+  }
+}
+
+#ifdef X86
+/* Every lane is at the same bit position, so one shift serves all four
+ * lanes at once. */
+__attribute__((target("avx2"))) static void unpack_avx2(const struct block *b,
+    const uint64_t *words, bool sorted, uint64_t *out) {
+  const __m256i m = _mm256_set1_epi64x((long long)MASK(b->bits));
+  __m256i acc = _mm256_set1_epi64x((long long)b->base), v;
+  int t, pos, off;
+
+  for (t = 0; t < PER_LANE; ++t) {
+    pos = t * b->bits;
+    off = pos % 64;
+    v = _mm256_srl_epi64(
+        _mm256_loadu_si256((const __m256i*)&words[LANES*(pos/64)]),
+        _mm_cvtsi32_si128(off));
+    if (off + b->bits > 64) {
+      v = _mm256_or_si256(v, _mm256_sll_epi64(
+            _mm256_loadu_si256((const __m256i*)&words[LANES*(pos/64 + 1)]),
+            _mm_cvtsi32_si128(64 - off)));
+    }
+    v = _mm256_and_si256(v, m);
+    if (sorted) {
+      acc = _mm256_add_epi64(acc, v);
+      _mm256_storeu_si256((__m256i*)&out[LANES*t], acc);
+    } else {
+      _mm256_storeu_si256((__m256i*)&out[LANES*t], _mm256_add_epi64(acc, v));
+    }
+  }
+}
+#endif
+
+/* Unpack all the values of block k into out. */
+static void unpack(const jx_intvec *self, int k, uint64_t *out) {
+  const struct block *b = jx_vector_at(&self->blocks, k);
+  const uint64_t *words = (const uint64_t*)jx_vector_data(&self->words) +
+    b->word;
+  int j;
+
+  if (0 == b->bits) {
+    for (j = 0; j < JX_INTVEC_BLOCK; ++j) {
+      out[j] = b->base;
+    }
+    return;
+  }
+#ifdef X86
+  if (has_avx2) {
+    unpack_avx2(b, words, self->sorted, out);
+    return;
+  }
+#endif
+  unpack_plain(b, words, self->sorted, out);
+}
+
+jx_result jx_intvec_from_vector(jx_intvec *out_self, const jx_vector *values,
+    bool sorted) {
+  uint64_t block[JX_INTVEC_BLOCK];
+  const unsigned char *items;
+  jx_result err = JX_OK;
+  int i, j, n;
+
+  JX_NOT_NULL(values);
+  assert((1 == values->isz || 2 == values->isz || 4 == values->isz ||
+        8 == values->isz) && "Values must be 1, 2, 4 or 8 byte integers.");
+
+  jx_intvec_init(out_self, sorted);
+  n = jx_vector_size(values);
+  items = jx_vector_data(values);
+  for (i = 0; JX_OK == err && i + JX_INTVEC_BLOCK <= n;
+      i += JX_INTVEC_BLOCK) {
+    for (j = 0; j < JX_INTVEC_BLOCK; ++j) {
+      block[j] = read_uint(&items[(i + j) * values->isz], values->isz);
+      assert((!sorted || (j ? block[j-1] : out_self->last) <= block[j]) &&
+          "The values of a sorted vector can't decrease.");
+    }
+    err = pack(out_self, block);
+    if (JX_OK == err) {
+      out_self->last = block[JX_INTVEC_BLOCK - 1];
+      out_self->size += JX_INTVEC_BLOCK;
+    }
+  }
+  for (; JX_OK == err && i < n; ++i) {
+    err = jx_intvec_append(out_self, read_uint(&items[i*values->isz],
+          values->isz));
+  }
+
+  if (JX_OK != err) jx_intvec_destroy(out_self);
+  return err;
+}
+
+/******************************************************************************/
+
+int jx_intvec_size(const jx_intvec *self) {
+  VALID(self);
+  return self->size;
+}
+
+size_t jx_intvec_bytes(const jx_intvec *self) {
+  VALID(self);
+  return jx_vector_size(&self->blocks) * sizeof(struct block) +
+    jx_vector_size(&self->words) * sizeof(uint64_t) +
+    jx_vector_size(&self->tail) * sizeof(uint64_t);
+}
+
+uint64_t jx_intvec_get(const jx_intvec *self, int i) {
+  const struct block *b;
+  const uint64_t *words;
+  uint64_t v, sum;
+  int k, l, t, pos;
+
+  VALID(self);
+  JX_RANGE(i, 0, self->size);
+
+  k = i / JX_INTVEC_BLOCK;
+  if (k == jx_vector_size(&self->blocks)) {
+    return *(uint64_t*)jx_vector_at(&self->tail, i % JX_INTVEC_BLOCK);
+  }
+  b = jx_vector_at(&self->blocks, k);
+  words = (const uint64_t*)jx_vector_data(&self->words) + b->word;
+  l = i % LANES;
+
+  /* a sorted value is the base plus the differences before it in its lane */
+  sum = b->base;
+  for (t = (self->sorted ? 0 : i % JX_INTVEC_BLOCK / LANES);
+      b->bits && t <= i % JX_INTVEC_BLOCK / LANES; ++t) {
+    pos = t * b->bits;
+    v = words[LANES*(pos/64) + l] >> (pos % 64);
+    if (pos % 64 + b->bits > 64) {
+      v |= words[LANES*(pos/64 + 1) + l] << (64 - pos % 64);
+    }
+    sum += v & MASK(b->bits);
+  }
+  return sum;
+}
+
+jx_result jx_intvec_append(jx_intvec *self, uint64_t val) {
+  VALID(self);
+  assert((!self->sorted || 0 == self->size || self->last <= val) &&
+      "The values of a sorted vector can't decrease.");
+
+  JX_TRY(jx_vector_append(&self->tail, 1, NULL));
+  *(uint64_t*)jx_vector_back(&self->tail) = val;
+  if (JX_INTVEC_BLOCK == jx_vector_size(&self->tail)) {
+    /* leave the values in the tail if they can't be packed */
+    if (JX_OK != pack(self, jx_vector_data(&self->tail))) {
+      jx_vector_pop_back(&self->tail, 1);
+      return JX_OUT_OF_MEMORY;
+    }
+    jx_vector_clear(&self->tail);
+  }
+  self->last = val;
+  self->size++;
+  return JX_OK;
+}
+
+jx_result jx_intvec_to_vector(const jx_intvec *self, jx_vector *dest) {
+  unsigned char *items;
+  jx_intvec_cursor cur;
+  const uint64_t *vals;
+  int i, count;
+
+  VALID(self);
+  JX_NOT_NULL(dest);
+  assert((1 == dest->isz || 2 == dest->isz || 4 == dest->isz ||
+        8 == dest->isz) && "Values must be 1, 2, 4 or 8 byte integers.");
+
+  if (0 == self->size) return JX_OK;
+  JX_TRY(jx_vector_append(dest, self->size, &items));
+
+  if (sizeof(uint64_t) == dest->isz) {
+    /* unpack straight into the destination */
+    for (i = 0; i < jx_vector_size(&self->blocks); ++i) {
+      unpack(self, i, (uint64_t*)items + i * JX_INTVEC_BLOCK);
+    }
+    memcpy((uint64_t*)items + i * JX_INTVEC_BLOCK,
+        jx_vector_data(&self->tail),
+        jx_vector_size(&self->tail) * sizeof(uint64_t));
+    return JX_OK;
+  }
+
+  jx_intvec_seek(self, 0, &cur);
+  while ((count = jx_intvec_next_run(&cur, &vals))) {
+    for (i = 0; i < count; ++i, items += dest->isz) {
+      write_uint(items, dest->isz, vals[i]);
+    }
+  }
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+void jx_intvec_seek(const jx_intvec *self, int i, jx_intvec_cursor *out_cursor) {
+  VALID(self);
+  JX_RANGE(i, 0, self->size + 1);
+  JX_NOT_NULL(out_cursor);
+
+  out_cursor->vec = self;
+  out_cursor->next = i;
+}
+
+int jx_intvec_next_run(jx_intvec_cursor *self, const uint64_t **out_values) {
+  const jx_intvec *vec;
+  int k, skip, count;
+
+  JX_NOT_NULL(self);
+  JX_NOT_NULL(out_values);
+  vec = self->vec;
+
+  if (self->next >= vec->size) return 0;
+  k = self->next / JX_INTVEC_BLOCK;
+  skip = self->next % JX_INTVEC_BLOCK;
+  if (k == jx_vector_size(&vec->blocks)) {
+    /* the tail isn't packed, hand it out as it is */
+    *out_values = (const uint64_t*)jx_vector_data(&vec->tail) + skip;
+    count = jx_vector_size(&vec->tail) - skip;
+  } else {
+    unpack(vec, k, self->values);
+    *out_values = self->values + skip;
+    count = JX_INTVEC_BLOCK - skip;
+  }
+  self->next += count;
+  return count;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_intvec intvec_var, *intvec = &intvec_var;
+
+jx_test intvec_sorted() {
+  jx_vector ids, back;
+  uint64_t *id;
+  bool simd;
+  int i, n = 10000;
+
+  JX_CATCH(jx_vector_init(&ids, sizeof(uint64_t), 0, NULL));
+  JX_CATCH(jx_vector_append(&ids, n, &id));
+  for (i = 0; i < n; ++i) {
+    /* big ids, close together, with some repeats */
+    id[i] = 1000000000000ull + i*37ull + (i % 5 ? 0 : 11) - (i % 3 == 1);
+  }
+
+  JX_CATCH(jx_intvec_from_vector(intvec, &ids, true));
+  JX_EXPECT(n == jx_intvec_size(intvec), "Incorrect size.");
+  JX_EXPECT(jx_intvec_bytes(intvec) * 6 < n * sizeof(uint64_t),
+      "Sorted ids didn't compress.");
+  for (i = 0; i < n; i += 97) {
+    JX_EXPECT(id[i] == jx_intvec_get(intvec, i), "Incorrect random access.");
+  }
+  JX_EXPECT(id[n-1] == jx_intvec_get(intvec, n-1), "Incorrect last value.");
+
+  JX_CATCH(jx_vector_init(&back, sizeof(uint64_t), 0, NULL));
+  JX_CATCH(jx_intvec_to_vector(intvec, &back));
+  JX_EXPECT(0 == memcmp(id, jx_vector_data(&back), n * sizeof *id),
+      "Converting back changed the values.");
+
+  /* the plain decode gives the same values */
+  simd = has_avx2;
+  has_avx2 = false;
+  jx_vector_clear(&back);
+  JX_CATCH(jx_intvec_to_vector(intvec, &back));
+  has_avx2 = simd;
+  JX_EXPECT(0 == memcmp(id, jx_vector_data(&back), n * sizeof *id),
+      "The plain decode changed the values.");
+
+  jx_vector_destroy(&back);
+  jx_vector_destroy(&ids);
+  jx_intvec_destroy(intvec);
+  return JX_PASS;
+}
+
+static uint64_t counter(int i) {
+  /* small counters, with a block of zeros and one of extremes */
+  if (i >= 256 && i < 384) return 0;
+  if (i >= 512 && i < 640) return (i % 2 ? ~(uint64_t)0 : 3);
+  return (i * 7919u) % 1000 + (i == 1000 ? 1ull << 40 : 0);
+}
+
+jx_test intvec_counters() {
+  jx_intvec_cursor cur;
+  const uint64_t *vals;
+  jx_vector small;
+  uint32_t *narrow;
+  bool simd;
+  int i, count, n = 3000;
+
+  jx_intvec_init(intvec, false);
+  for (i = 0; i < n; ++i) {
+    JX_CATCH(jx_intvec_append(intvec, counter(i)));
+  }
+  JX_EXPECT(n == jx_intvec_size(intvec), "Incorrect size.");
+  for (i = 0; i < n; ++i) {
+    JX_EXPECT(counter(i) == jx_intvec_get(intvec, i),
+        "Incorrect random access.");
+  }
+
+  /* the plain decode gives the same values */
+  simd = has_avx2;
+  has_avx2 = false;
+  jx_intvec_seek(intvec, 0, &cur);
+  for (i = 0; (count = jx_intvec_next_run(&cur, &vals)); ) {
+    for (; count > 0 && counter(i) == *vals; --count, ++i, ++vals);
+    if (count > 0) break;
+  }
+  has_avx2 = simd;
+  JX_EXPECT(n == i, "Incorrect value from the plain decode.");
+
+  /* stream from part way into a block */
+  jx_intvec_seek(intvec, 300, &cur);
+  for (i = 300; (count = jx_intvec_next_run(&cur, &vals)); ) {
+    for (; count > 0; --count, ++i, ++vals) {
+      JX_EXPECT(counter(i) == *vals, "Incorrect streamed value.");
+    }
+  }
+  JX_EXPECT(n == i, "Streaming missed values.");
+  jx_intvec_destroy(intvec);
+
+  /* from and back to 32 bit counters */
+  JX_CATCH(jx_vector_init(&small, sizeof(uint32_t), 0, NULL));
+  JX_CATCH(jx_vector_append(&small, n, &narrow));
+  for (i = 0; i < n; ++i) {
+    narrow[i] = (uint32_t)((i * 7919u) % 1000);
+  }
+  JX_CATCH(jx_intvec_from_vector(intvec, &small, false));
+  JX_EXPECT(jx_intvec_bytes(intvec) * 2 < n * sizeof(uint32_t),
+      "Small counters didn't compress.");
+  jx_vector_clear(&small);
+  JX_CATCH(jx_intvec_to_vector(intvec, &small));
+  narrow = jx_vector_data(&small);
+  for (i = 0; i < n; ++i) {
+    JX_EXPECT((i * 7919u) % 1000 == narrow[i], "Incorrect narrow value.");
+  }
+
+  jx_vector_destroy(&small);
+  jx_intvec_destroy(intvec);
+  return JX_PASS;
+}
+
+#endif
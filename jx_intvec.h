@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_INTVEC_H
+#define JX_INTVEC_H
+#include "jinks.h"
+
+/* A compressed, append-only vector of 64-bit unsigned integers. Values are
+ * packed in blocks of JX_INTVEC_BLOCK, each stored as offsets from a base in
+ * just enough bits for the largest offset (frame of reference). A sorted
+ * vector stores the differences between neighbouring values instead, which
+ * is much smaller for ids and timestamps. Blocks are laid out four values
+ * across, so that one AVX2 register unpacks four at a time. */
+
+/* sorted vectors take only values that don't decrease. */
+void jx_intvec_init(jx_intvec *out_self, bool sorted);
+
+/* Compress the items of values, which are unsigned integers of 1, 2, 4 or 8
+ * bytes.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_intvec_from_vector(jx_intvec *out_self, const jx_vector *values,
+    bool sorted);
+
+void jx_intvec_destroy(void *intvec);
+
+/******************************************************************************/
+
+int jx_intvec_size(const jx_intvec *self);
+
+/* bytes taken by the compressed values */
+size_t jx_intvec_bytes(const jx_intvec *self);
+
+/* Random access finds the block from its index and unpacks a single value,
+ * though a sorted vector has to add up the differences before it. */
+uint64_t jx_intvec_get(const jx_intvec *self, int i);
+
+/* Errors: JX_OUT_OF_MEMORY */
+jx_result jx_intvec_append(jx_intvec *self, uint64_t val);
+
+/* Append every value to dest, whose items are unsigned integers of 1, 2, 4
+ * or 8 bytes; values must fit.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_intvec_to_vector(const jx_intvec *self, jx_vector *dest);
+
+/******************************************************************************/
+
+/* Stream the values from index i on, a block at a time. Appending to the
+ * vector invalidates its cursors. */
+void jx_intvec_seek(const jx_intvec *self, int i, jx_intvec_cursor *out_cursor);
+
+/* Get the next run of values in out_values. Returns the count, 0 at the
+ * end. The values stay valid until the next call. */
+int jx_intvec_next_run(jx_intvec_cursor *self, const uint64_t **out_values);
+
+#endif /* end of header guard */
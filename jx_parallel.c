@@ -0,0 +1,652 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_parallel.h"
+#include "jx_slice.h"
+#include "jx_sort.h"
+#include "jx_vector.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(self->data); \
+  JX_POSITIVE(self->data->nworkers)
+
+/* number of parts per worker when the caller doesn't pick a grain */
+#define PARTS_PER_WORKER 8
+
+struct task {
+  void (*run)(void *job, int i);
+  void *job;
+  int i;
+  int *pending;
+};
+
+struct worker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  /* the deque: the owner pushes and pops at the back, thieves take the
+   * task at head. */
+  jx_vector tasks;
+  int head;
+  struct pool_data *pool;
+};
+
+struct pool_data {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  /* tasks sitting in the deques. Only raised while holding lock, so that
+   * nobody misses the wake up. */
+  int queued;
+  bool stop;
+  int nworkers;
+  struct worker *workers;
+};
+
+/* the worker running on this thread, NULL if it isn't a pool thread. */
+static __thread struct worker *current = NULL;
+
+/******************************************************************************/
+
+static bool pop_back(struct worker *w, struct task *out_task) {
+  bool found = false;
+  pthread_mutex_lock(&w->lock);
+  if (jx_vector_size(&w->tasks) > w->head) {
+    memcpy(out_task, jx_vector_back(&w->tasks), sizeof *out_task);
+    jx_vector_pop_back(&w->tasks, 1);
+    found = true;
+  }
+  if (jx_vector_size(&w->tasks) == w->head) {
+    jx_vector_clear(&w->tasks);
+    w->head = 0;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+static bool steal_front(struct worker *w, struct task *out_task) {
+  bool found = false;
+  pthread_mutex_lock(&w->lock);
+  if (jx_vector_size(&w->tasks) > w->head) {
+    memcpy(out_task, jx_vector_at(&w->tasks, w->head++), sizeof *out_task);
+    found = true;
+  }
+  if (jx_vector_size(&w->tasks) == w->head) {
+    jx_vector_clear(&w->tasks);
+    w->head = 0;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+static bool take_task(struct pool_data *pool, struct task *out_task) {
+  struct worker *me = (current && current->pool == pool ? current : NULL);
+  int k, first = (me ? (int)(me - pool->workers) + 1 : 0);
+  bool found = false;
+
+  if (me) found = pop_back(me, out_task);
+  for (k = 0; !found && k < pool->nworkers; ++k) {
+    struct worker *victim = &pool->workers[(first + k) % pool->nworkers];
+    if (victim != me) found = steal_front(victim, out_task);
+  }
+  if (found) __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+  return found;
+}
+
+static void run_task(struct pool_data *pool, struct task *t) {
+  t->run(t->job, t->i);
+  if (0 == __atomic_sub_fetch(t->pending, 1, __ATOMIC_ACQ_REL)) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/* Block until pending drops to zero, running queued tasks meanwhile. */
+static void wait_for(struct pool_data *pool, int *pending) {
+  struct task t;
+
+  while (__atomic_load_n(pending, __ATOMIC_ACQUIRE) > 0) {
+    if (take_task(pool, &t)) {
+      run_task(pool, &t);
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(pending, __ATOMIC_ACQUIRE) > 0
+        && __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <= 0) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/* Run task i of job for every i in [0, n) and wait for all of them. From a
+ * worker the tasks go on its own deque, otherwise they are dealt out in
+ * contiguous blocks so that neighbouring parts start on the same worker. A
+ * block that can't be queued (out of memory) runs on this thread instead. */
+static void run_all(struct pool_data *pool, void (*run)(void*, int),
+    void *job, int n) {
+  bool local = (current && current->pool == pool), queued;
+  int k, i, lo, hi, blocks, pending = n;
+  struct worker *w;
+  struct task *t, inline_task;
+
+  blocks = (local ? 1 : pool->nworkers);
+  for (k = 0; k < blocks; ++k) {
+    w = (local ? current : &pool->workers[k]);
+    lo = (int)((long)n * k / blocks);
+    hi = (int)((long)n * (k+1) / blocks);
+    if (lo == hi) continue;
+
+    pthread_mutex_lock(&w->lock);
+    queued = (JX_OK == jx_vector_append(&w->tasks, hi - lo, &t));
+    for (i = lo; queued && i < hi; ++i, ++t) {
+      t->run = run;
+      t->job = job;
+      t->i = i;
+      t->pending = &pending;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (queued) {
+      pthread_mutex_lock(&pool->lock);
+      __atomic_add_fetch(&pool->queued, hi - lo, __ATOMIC_RELAXED);
+      pthread_cond_broadcast(&pool->wake);
+      pthread_mutex_unlock(&pool->lock);
+    } else {
+      for (i = lo; i < hi; ++i) {
+        inline_task.run = run;
+        inline_task.job = job;
+        inline_task.i = i;
+        inline_task.pending = &pending;
+        run_task(pool, &inline_task);
+      }
+    }
+  }
+  wait_for(pool, &pending);
+}
+
+/******************************************************************************/
+
+static void* worker_main(void *arg) {
+  struct worker *self = arg;
+  struct pool_data *pool = self->pool;
+  struct task t;
+
+  current = self;
+  for (;;) {
+    if (take_task(pool, &t)) {
+      run_task(pool, &t);
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop
+        && __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <= 0) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->stop) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  current = NULL;
+  return NULL;
+}
+
+/* stop and join the first 'started' workers, then release everything. */
+static void shutdown_pool(struct pool_data *pool, int started) {
+  int k;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (k = 0; k < started; ++k) {
+    pthread_join(pool->workers[k].thread, NULL);
+  }
+  for (k = 0; k < pool->nworkers; ++k) {
+    pthread_mutex_destroy(&pool->workers[k].lock);
+    jx_vector_destroy(&pool->workers[k].tasks);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
+
+jx_result jx_pool_init(jx_pool *out_self, int workers) {
+  struct pool_data *pool;
+  int k;
+
+  JX_NOT_NULL(out_self);
+  JX_NOT_NEG(workers);
+
+  if (0 == workers) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1) workers = 1;
+
+  pool = malloc(sizeof *pool);
+  if (NULL == pool) return JX_OUT_OF_MEMORY;
+  pool->workers = calloc(workers, sizeof *pool->workers);
+  if (NULL == pool->workers) {
+    free(pool);
+    return JX_OUT_OF_MEMORY;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pool->queued = 0;
+  pool->stop = false;
+  pool->nworkers = workers;
+  out_self->data = pool;
+
+  /* every deque must exist before the first thread starts stealing */
+  for (k = 0; k < workers; ++k) {
+    struct worker *w = &pool->workers[k];
+    pthread_mutex_init(&w->lock, NULL);
+    w->head = 0;
+    w->pool = pool;
+    /* an empty vector doesn't allocate, this can't fail */
+    jx_vector_init(&w->tasks, sizeof(struct task), 0, NULL);
+  }
+
+  for (k = 0; k < workers; ++k) {
+    if (0 != pthread_create(&pool->workers[k].thread, NULL, worker_main,
+          &pool->workers[k])) {
+      break;
+    }
+  }
+
+  /* couldn't start all the threads, stop the ones that did start */
+  if (k < workers) {
+    shutdown_pool(pool, k);
+    out_self->data = NULL;
+    return JX_OUT_OF_MEMORY;
+  }
+
+  VALID(out_self);
+  return JX_OK;
+}
+
+void jx_pool_destroy(void *pool) {
+  jx_pool *self = pool;
+  VALID(self);
+
+  shutdown_pool(self->data, self->data->nworkers);
+  memset(self, 0, sizeof *self);
+}
+
+int jx_pool_workers(const jx_pool *self) {
+  VALID(self);
+  return self->data->nworkers;
+}
+
+/******************************************************************************/
+
+/* Reslice slice into parts of grain items, stored in out_parts. All the
+ * reference counting happens here, on the calling thread. */
+static jx_result split_slice(const jx_pool *self, const jx_slice *slice,
+    int grain, jx_vector *out_parts) {
+  jx_slice *part;
+  int i, n, per_line, count = jx_slice_count(slice);
+
+  if (0 == grain) {
+    grain = count / (self->data->nworkers * PARTS_PER_WORKER);
+    if (grain < 1) grain = 1;
+    /* pad parts of small, packed items to whole cache lines, so that the
+     * workers don't write to the same lines (given a slice aligned to
+     * JX_CACHE_LINE, see jx_slice_init_aligned). */
+    if (slice->stride > 0 && 0 == JX_CACHE_LINE % slice->stride) {
+      per_line = JX_CACHE_LINE / slice->stride;
+      grain = (grain + per_line - 1) / per_line * per_line;
+    }
+  }
+  n = (count + grain - 1) / grain;
+
+  JX_TRY(jx_vector_init(out_parts, sizeof(jx_slice), n, jx_slice_destroy));
+  for (i = 0; i < n; ++i) {
+    /* reserved up front, this won't fail */
+    jx_vector_append(out_parts, 1, &part);
+    jx_slice_reslice(slice, i*grain, 1, grain, part);
+  }
+  return JX_OK;
+}
+
+struct for_job {
+  jx_vector parts;
+  jx_slice_fn fn;
+  void *ctx;
+};
+
+static void run_for(void *job, int i) {
+  struct for_job *self = job;
+  self->fn(jx_vector_at(&self->parts, i), self->ctx);
+}
+
+jx_result jx_parallel_for(jx_pool *self, const jx_slice *slice, int grain,
+    jx_slice_fn fn, void *ctx) {
+  struct for_job job;
+
+  VALID(self);
+  JX_NOT_NULL(slice);
+  JX_NOT_NULL(fn);
+  JX_NOT_NEG(grain);
+
+  JX_TRY(split_slice(self, slice, grain, &job.parts));
+  job.fn = fn;
+  job.ctx = ctx;
+  run_all(self->data, run_for, &job, jx_vector_size(&job.parts));
+  jx_vector_destroy(&job.parts);
+  return JX_OK;
+}
+
+struct reduce_job {
+  jx_vector parts, partials;
+  jx_reduce_fn reduce;
+  void *ctx;
+};
+
+static void run_reduce(void *job, int i) {
+  struct reduce_job *self = job;
+  self->reduce(jx_vector_at(&self->parts, i),
+      jx_vector_at(&self->partials, i), self->ctx);
+}
+
+jx_result jx_parallel_reduce(jx_pool *self, const jx_slice *slice, int grain,
+    size_t rsz, jx_reduce_fn reduce, jx_combine_fn combine, void *ctx,
+    void *result) {
+  struct reduce_job job;
+  unsigned char *partial;
+  jx_result err;
+  int i, n;
+
+  VALID(self);
+  JX_NOT_NULL(slice);
+  JX_NOT_NULL(reduce);
+  JX_NOT_NULL(combine);
+  JX_NOT_NULL(result);
+  JX_POSITIVE(rsz);
+  JX_NOT_NEG(grain);
+
+  JX_TRY(split_slice(self, slice, grain, &job.parts));
+  n = jx_vector_size(&job.parts);
+  err = jx_vector_init(&job.partials, rsz, n, NULL);
+  if (JX_OK != err) {
+    jx_vector_destroy(&job.parts);
+    return err;
+  }
+  if (n > 0) {
+    jx_vector_append(&job.partials, n, &partial);
+    for (i = 0; i < n; ++i) {
+      memcpy(&partial[i*rsz], result, rsz);
+    }
+  }
+
+  job.reduce = reduce;
+  job.ctx = ctx;
+  run_all(self->data, run_reduce, &job, n);
+  for (i = 0; i < n; ++i) {
+    combine(result, jx_vector_at(&job.partials, i), ctx);
+  }
+
+  jx_vector_destroy(&job.partials);
+  jx_vector_destroy(&job.parts);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+struct sort_job {
+  unsigned char *src, *dst;
+  size_t isz;
+  jx_compare cmp;
+  int nruns, width, pieces;
+  int *bounds;
+};
+
+static void run_sort(void *job, int i) {
+  struct sort_job *self = job;
+  int lo = self->bounds[i], hi = self->bounds[i+1];
+  jx_merge_sort(&self->src[lo*self->isz], &self->dst[lo*self->isz], hi - lo,
+      self->isz, self->cmp);
+}
+
+/* first item of the sorted array that isn't less than key */
+static int lower_bound(const unsigned char *items, int lo, int hi,
+    const void *key, size_t isz, jx_compare cmp) {
+  int mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (cmp(&items[mid*isz], key) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Task i merges one piece of a pair of neighbouring runs. The left run is
+ * cut into equal pieces and the matching cut in the right run is found by
+ * binary search, so the pieces can be merged independently and the last
+ * rounds (with few, long runs) still use every worker. */
+static void run_merge(void *job, int i) {
+  struct sort_job *self = job;
+  int w = self->width, n = self->nruns, pair = i / self->pieces;
+  int piece = i % self->pieces, a0, a1, b0, b1;
+  int lo = self->bounds[2*pair*w < n ? 2*pair*w : n];
+  int mid = self->bounds[(2*pair+1)*w < n ? (2*pair+1)*w : n];
+  int hi = self->bounds[(2*pair+2)*w < n ? (2*pair+2)*w : n];
+  size_t isz = self->isz;
+
+  a0 = lo + (int)((long)(mid - lo) * piece / self->pieces);
+  a1 = lo + (int)((long)(mid - lo) * (piece+1) / self->pieces);
+  b0 = (0 == piece ? mid :
+      lower_bound(self->src, mid, hi, &self->src[a0*isz], isz, self->cmp));
+  b1 = (a1 == mid ? hi :
+      lower_bound(self->src, mid, hi, &self->src[a1*isz], isz, self->cmp));
+
+  jx_merge(&self->dst[(a0 + b0 - mid)*isz], &self->src[a0*isz], a1 - a0,
+      &self->src[b0*isz], b1 - b0, isz, self->cmp);
+}
+
+jx_result jx_parallel_sort(jx_pool *self, jx_vector *vector, jx_compare cmp) {
+  struct sort_job job;
+  jx_vector bounds;
+  unsigned char *scratch, *tmp;
+  int i, size, pairs;
+
+  VALID(self);
+  JX_NOT_NULL(vector);
+  JX_NOT_NULL(cmp);
+
+  size = jx_vector_size(vector);
+  if (size < 2) return JX_OK;
+
+  job.isz = vector->isz;
+  job.cmp = cmp;
+  job.nruns = self->data->nworkers * 2;
+  if (job.nruns > size) job.nruns = size;
+
+  scratch = malloc(size * job.isz);
+  if (NULL == scratch) return JX_OUT_OF_MEMORY;
+  if (JX_OK != jx_vector_init(&bounds, sizeof(int), job.nruns+1, NULL)) {
+    free(scratch);
+    return JX_OUT_OF_MEMORY;
+  }
+  jx_vector_append(&bounds, job.nruns+1, &job.bounds);
+  for (i = 0; i <= job.nruns; ++i) {
+    job.bounds[i] = (int)((long)size * i / job.nruns);
+  }
+
+  /* sort the runs, then merge pairs of runs until only one is left,
+   * swapping the roles of the two buffers after every round. */
+  job.src = jx_vector_data(vector);
+  job.dst = scratch;
+  run_all(self->data, run_sort, &job, job.nruns);
+  for (job.width = 1; job.width < job.nruns; job.width *= 2) {
+    pairs = (job.nruns + 2*job.width - 1) / (2*job.width);
+    job.pieces = (job.nruns + pairs - 1) / pairs;
+    run_all(self->data, run_merge, &job, pairs * job.pieces);
+    tmp = job.src; job.src = job.dst; job.dst = tmp;
+  }
+  if (job.src != vector->data) {
+    memcpy(vector->data, job.src, size * job.isz);
+  }
+
+  jx_vector_destroy(&bounds);
+  free(scratch);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_pool pool_var, *pool = &pool_var;
+
+static void square_part(const jx_slice *part, void *ctx) {
+  int i, *val;
+  for (i = 0; i < jx_slice_count(part); ++i) {
+    val = jx_slice_get(part, i);
+    *val = *val * *val;
+  }
+}
+
+jx_test parallel_for() {
+  jx_slice slice, odds;
+  int i;
+
+  JX_CATCH(jx_pool_init(pool, 4));
+  JX_EXPECT(4 == jx_pool_workers(pool), "Incorrect number of workers.");
+
+  JX_CATCH(jx_slice_init(&slice, sizeof(int), 1000));
+  for (i = 0; i < 1000; ++i) {
+    *(int*)jx_slice_get(&slice, i) = i;
+  }
+
+  /* square only the odd items, with an uneven grain */
+  jx_slice_reslice(&slice, 1, 2, 500, &odds);
+  JX_CATCH(jx_parallel_for(pool, &odds, 7, square_part, NULL));
+  jx_slice_destroy(&odds);
+
+  for (i = 0; i < 1000; ++i) {
+    JX_EXPECT((i % 2 ? i*i : i) == *(int*)jx_slice_get(&slice, i),
+        "Parallel for didn't visit the right items.");
+  }
+
+  jx_slice_destroy(&slice);
+  jx_pool_destroy(pool);
+  return JX_PASS;
+}
+
+static void check_line(const jx_slice *part, void *ctx) {
+  if ((uintptr_t)jx_slice_get(part, 0) % JX_CACHE_LINE) {
+    __atomic_add_fetch((int*)ctx, 1, __ATOMIC_RELAXED);
+  }
+}
+
+jx_test parallel_for_padding() {
+  jx_slice slice;
+  int shared = 0;
+
+  JX_CATCH(jx_pool_init(pool, 3));
+  JX_CATCH(jx_slice_init_aligned(&slice, sizeof(float), 10001,
+        JX_CACHE_LINE));
+  JX_CATCH(jx_parallel_for(pool, &slice, 0, check_line, &shared));
+  JX_EXPECT(0 == shared, "Parts should start on a cache line.");
+
+  jx_slice_destroy(&slice);
+  jx_pool_destroy(pool);
+  return JX_PASS;
+}
+
+static void sum_part(const jx_slice *part, void *partial, void *ctx) {
+  int i;
+  for (i = 0; i < jx_slice_count(part); ++i) {
+    *(long*)partial += *(int*)jx_slice_get(part, i);
+  }
+}
+
+static void add_partial(void *result, const void *partial, void *ctx) {
+  *(long*)result += *(const long*)partial;
+}
+
+/* a reduce whose parts run nested parallel reductions on the same pool. */
+static void nested_sum(const jx_slice *part, void *partial, void *ctx) {
+  jx_parallel_reduce(ctx, part, 3, sizeof(long), sum_part, add_partial,
+      NULL, partial);
+}
+
+jx_test parallel_reduce() {
+  jx_slice slice;
+  long total;
+  int i;
+
+  JX_CATCH(jx_pool_init(pool, 3));
+  JX_CATCH(jx_slice_init(&slice, sizeof(int), 10001));
+  for (i = 0; i < 10001; ++i) {
+    *(int*)jx_slice_get(&slice, i) = i;
+  }
+
+  total = 0;
+  JX_CATCH(jx_parallel_reduce(pool, &slice, 0, sizeof total, sum_part,
+        add_partial, NULL, &total));
+  JX_EXPECT(50005000 == total, "Parallel reduce has the wrong result.");
+
+  total = 0;
+  JX_CATCH(jx_parallel_reduce(pool, &slice, 100, sizeof total, nested_sum,
+        add_partial, pool, &total));
+  JX_EXPECT(50005000 == total, "Nested parallel reduce has the wrong result.");
+
+  jx_slice_destroy(&slice);
+  jx_pool_destroy(pool);
+  return JX_PASS;
+}
+
+static int compare_ints(const void *a, const void *b) {
+  int x = *(const int*)a, y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+static int compare_tens(const void *a, const void *b) {
+  int x = *(const int*)a / 10, y = *(const int*)b / 10;
+  return (x > y) - (x < y);
+}
+
+jx_test parallel_sort() {
+  jx_vector vec;
+  int i, *vals;
+
+  JX_CATCH(jx_pool_init(pool, 5));
+  JX_CATCH(jx_vector_init(&vec, sizeof(int), 0, NULL));
+  JX_CATCH(jx_vector_append(&vec, 9999, &vals));
+  for (i = 0; i < 9999; ++i) {
+    vals[i] = (i * 7919) % 9999;
+  }
+
+  JX_CATCH(jx_parallel_sort(pool, &vec, compare_ints));
+  vals = jx_vector_data(&vec);
+  for (i = 0; i < 9999; ++i) {
+    JX_EXPECT(i == vals[i], "The vector isn't sorted.");
+  }
+
+  /* sorting by tens only: items with equal tens must keep their order */
+  for (i = 0; i < 9999; ++i) {
+    vals[i] = (i % 100)*10 + i / 1000;
+  }
+  JX_CATCH(jx_parallel_sort(pool, &vec, compare_tens));
+  for (i = 1; i < 9999; ++i) {
+    JX_EXPECT(vals[i-1] / 10 < vals[i] / 10 || vals[i-1] <= vals[i],
+        "The parallel sort isn't stable.");
+  }
+
+  jx_vector_destroy(&vec);
+  jx_pool_destroy(pool);
+  return JX_PASS;
+}
+
+#endif
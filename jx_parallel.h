@@ -0,0 +1,53 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_PARALLEL_H
+#define JX_PARALLEL_H
+#include "jinks.h"
+
+/* A pool of worker threads with a task deque per worker. Workers run their
+ * own tasks newest first and, when they run dry, steal the oldest tasks of
+ * the other workers. The parallel algorithms below block until all their
+ * tasks are done; while waiting, the calling thread runs tasks too, so they
+ * may be called from within a task that is itself running on the pool. */
+
+typedef void (*jx_slice_fn)(const jx_slice *part, void *ctx);
+
+typedef void (*jx_reduce_fn)(const jx_slice *part, void *partial, void *ctx);
+
+typedef void (*jx_combine_fn)(void *result, const void *partial, void *ctx);
+
+jx_result jx_pool_init(jx_pool *out_self, int workers);
+
+void jx_pool_destroy(void *pool);
+
+int jx_pool_workers(const jx_pool *self);
+
+/******************************************************************************/
+
+/* Split slice into parts of (at most) grain items and call fn on each part.
+ * Parts are made with jx_slice_reslice and destroyed when the call returns.
+ * A grain of 0 picks a size from the number of workers.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_parallel_for(jx_pool *self, const jx_slice *slice, int grain,
+    jx_slice_fn fn, void *ctx);
+
+/* Reduce every part into its own partial result of rsz bytes, then combine
+ * the partials into result in the order of the parts. On entry result holds
+ * the identity, which is also used to initialize each partial.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_parallel_reduce(jx_pool *self, const jx_slice *slice, int grain,
+    size_t rsz, jx_reduce_fn reduce, jx_combine_fn combine, void *ctx,
+    void *result);
+
+/* Stable merge sort of the items of vector with cmp: runs are sorted in
+ * parallel, then merged pairwise with every merge split across workers.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_parallel_sort(jx_pool *self, jx_vector *vector, jx_compare cmp);
+
+#endif /* end of header guard */
@@ -0,0 +1,421 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_pipeline.h"
+#include "jx_pointer.h"
+#include "jx_slice.h"
+#include "jx_vector.h"
+#include <stddef.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_POSITIVE(self->isz); \
+  JX_NOT_NEG(self->source.count)
+
+/* Bytes in each of the two buffers that a block moves between, small enough
+ * that both stay in L1 along with whatever the stage functions touch. */
+#define BLOCK_BYTES 8192
+
+enum stage_kind { MAP, FILTER, TAKE, ZIP };
+
+struct stage {
+  enum stage_kind kind;
+  jx_map_fn map;
+  jx_filter_fn filter;
+  void *ctx;
+  size_t osz;         /* size of the items coming out */
+  int count;          /* items to take */
+  jx_slice other;     /* zipped with */
+  size_t other_sz;    /* and the size and place of its items in the pairs */
+  size_t at;
+  int seen;           /* items let through so far in this run */
+};
+
+static void destroy_stage(void *item) {
+  struct stage *s = item;
+  if (ZIP == s->kind) jx_slice_destroy(&s->other);
+}
+
+static jx_result add_stage(jx_pipeline *self, const struct stage *s) {
+  struct stage *added;
+
+  VALID(self);
+  JX_TRY(jx_vector_append(&self->stages, 1, &added));
+  *added = *s;
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+static void init_stages(jx_pipeline *self) {
+  /* empty vectors don't allocate, these can't fail */
+  jx_vector_init(&self->stages, sizeof(struct stage), 0, destroy_stage);
+}
+
+void jx_pipeline_init(jx_pipeline *out_self, const jx_slice *source,
+    size_t isz) {
+  JX_NOT_NULL(out_self);
+  JX_NOT_NULL(source);
+  JX_POSITIVE(isz);
+
+  out_self->source = *source;
+  jx_pointer_clone(&source->ptr, &out_self->source.ptr);
+  out_self->isz = isz;
+  init_stages(out_self);
+  VALID(out_self);
+}
+
+jx_result jx_pipeline_init_vector(jx_pipeline *out_self,
+    const jx_vector *vector) {
+  JX_NOT_NULL(out_self);
+  JX_NOT_NULL(vector);
+
+  JX_TRY(jx_pointer_wrap(&out_self->source.ptr, jx_vector_data(vector),
+        NULL));
+  out_self->source.start = 0;
+  out_self->source.stride = vector->isz;
+  out_self->source.count = jx_vector_size(vector);
+  out_self->isz = vector->isz;
+  init_stages(out_self);
+  VALID(out_self);
+  return JX_OK;
+}
+
+void jx_pipeline_destroy(void *pipeline) {
+  jx_pipeline *self = pipeline;
+  VALID(self);
+
+  jx_vector_destroy(&self->stages);
+  jx_slice_destroy(&self->source);
+  memset(self, 0, sizeof *self);
+}
+
+size_t jx_pipeline_itemsize(const jx_pipeline *self) {
+  VALID(self);
+  if (jx_vector_isempty(&self->stages)) return self->isz;
+  return ((struct stage*)jx_vector_back(&self->stages))->osz;
+}
+
+/******************************************************************************/
+
+jx_result jx_pipeline_map(jx_pipeline *self, jx_map_fn fn, size_t osz,
+    void *ctx) {
+  struct stage s = { MAP };
+
+  JX_NOT_NULL(fn);
+  JX_POSITIVE(osz);
+  s.map = fn;
+  s.ctx = ctx;
+  s.osz = osz;
+  return add_stage(self, &s);
+}
+
+jx_result jx_pipeline_filter(jx_pipeline *self, jx_filter_fn fn, void *ctx) {
+  struct stage s = { FILTER };
+
+  JX_NOT_NULL(fn);
+  s.filter = fn;
+  s.ctx = ctx;
+  s.osz = jx_pipeline_itemsize(self);
+  return add_stage(self, &s);
+}
+
+jx_result jx_pipeline_take(jx_pipeline *self, int count) {
+  struct stage s = { TAKE };
+
+  JX_NOT_NEG(count);
+  s.count = count;
+  s.osz = jx_pipeline_itemsize(self);
+  return add_stage(self, &s);
+}
+
+jx_result jx_pipeline_zip(jx_pipeline *self, const jx_slice *other,
+    size_t osz, size_t at, size_t zsz) {
+  struct stage s = { ZIP };
+  jx_result result;
+
+  JX_NOT_NULL(other);
+  JX_POSITIVE(osz);
+  assert(at >= jx_pipeline_itemsize(self) && at + osz <= zsz &&
+      "The pair's members overlap or don't fit.");
+  s.other = *other;
+  jx_pointer_clone(&other->ptr, &s.other.ptr);
+  s.other_sz = osz;
+  s.at = at;
+  s.osz = zsz;
+  if (JX_OK != (result = add_stage(self, &s))) {
+    jx_slice_destroy(&s.other);
+  }
+  return result;
+}
+
+/******************************************************************************/
+
+/* Where each block of output goes. */
+typedef jx_result (*sink_fn)(jx_slice *block, size_t isz, void *ctx);
+
+static void swap_buffers(jx_slice **a, jx_slice **b) {
+  jx_slice *t = *a;
+  *a = *b;
+  *b = t;
+}
+
+/* Gather items first to first + n of a zipped slice into dest. */
+static void gather_other(const struct stage *s, int first, int n,
+    unsigned char *dest) {
+  jx_slice part = s->other;
+
+  part.start += first * part.stride;
+  part.count = n;
+  jx_slice_copy_to(&part, s->other_sz, dest);
+}
+
+/* Run one block of n items of isz bytes, in a, through every stage, with c
+ * as scratch space. Returns the number of items left in a, whose size is
+ * then isz; sets stop once a stage wants no more input. */
+static int run_stages(jx_pipeline *self, jx_slice **a, jx_slice **b,
+    unsigned char *c, int n, size_t *isz, bool *stop) {
+  unsigned char *in, *out;
+  struct stage *s = jx_vector_data(&self->stages);
+  struct stage *end = s + jx_vector_size(&self->stages);
+  int i, k;
+
+  for (; s != end; ++s) {
+    in = jx_pointer_get(&(*a)->ptr);
+    out = jx_pointer_get(&(*b)->ptr);
+    switch (s->kind) {
+      case MAP:
+        for (i = 0; i < n; ++i) {
+          s->map(&in[i * *isz], &out[i*s->osz], s->ctx);
+        }
+        swap_buffers(a, b);
+        break;
+      case FILTER:
+        for (i = k = 0; i < n; ++i) {
+          if (!s->filter(&in[i * *isz], s->ctx)) continue;
+          if (k != i) memcpy(&in[k * *isz], &in[i * *isz], *isz);
+          ++k;
+        }
+        n = k;
+        break;
+      case TAKE:
+        if (n >= s->count - s->seen) {
+          n = s->count - s->seen;
+          *stop = true;
+        }
+        break;
+      case ZIP:
+        if (n >= s->other.count - s->seen) {
+          n = s->other.count - s->seen;
+          *stop = true;
+        }
+        gather_other(s, s->seen, n, c);
+        if (s->osz > *isz + s->other_sz) memset(out, 0, n * s->osz);
+        for (i = 0; i < n; ++i) {
+          memcpy(&out[i*s->osz], &in[i * *isz], *isz);
+          memcpy(&out[i*s->osz + s->at], &c[i*s->other_sz], s->other_sz);
+        }
+        swap_buffers(a, b);
+        break;
+    }
+    s->seen += n;
+    *isz = s->osz;
+  }
+  return n;
+}
+
+/* Pull the source through the stages a block at a time and hand each
+ * non-empty block of output to sink. */
+static jx_result run(jx_pipeline *self, sink_fn sink, void *ctx) {
+  jx_slice buffers[3], *a = &buffers[0], *b = &buffers[1], block;
+  struct stage *s = jx_vector_data(&self->stages);
+  struct stage *end = s + jx_vector_size(&self->stages);
+  size_t widest = self->isz, isz;
+  int per_block, pos, n, i;
+  bool stop = false;
+  jx_result result = JX_OK;
+
+  VALID(self);
+  for (; s != end; ++s) {
+    s->seen = 0;
+    if (s->osz > widest) widest = s->osz;
+  }
+  per_block = BLOCK_BYTES / widest;
+  if (per_block < 1) per_block = 1;
+
+  /* the third buffer holds the items gathered from a zipped slice, which
+   * are never wider than the pairs */
+  for (i = 0; i < 3; ++i) {
+    result = jx_slice_init_aligned(&buffers[i], widest, per_block,
+        JX_CACHE_LINE);
+    if (JX_OK != result) {
+      while (i-- > 0) jx_slice_destroy(&buffers[i]);
+      return result;
+    }
+  }
+
+  block = self->source;
+  for (pos = 0; pos < self->source.count && !stop; pos += block.count) {
+    /* gather the block, however the source is strided, into whole items */
+    block.start = self->source.start + pos*self->source.stride;
+    block.count = self->source.count - pos;
+    if (block.count > per_block) block.count = per_block;
+    jx_slice_copy_to(&block, self->isz, jx_pointer_get(&a->ptr));
+
+    isz = self->isz;
+    n = run_stages(self, &a, &b, jx_pointer_get(&buffers[2].ptr),
+        block.count, &isz, &stop);
+    if (0 == n) continue;
+    a->start = 0;
+    a->stride = isz;
+    a->count = n;
+    if (JX_OK != (result = sink(a, isz, ctx))) break;
+  }
+
+  for (i = 0; i < 3; ++i) {
+    jx_slice_destroy(&buffers[i]);
+  }
+  return result;
+}
+
+static jx_result collect_block(jx_slice *block, size_t isz, void *ctx) {
+  jx_vector *dest = ctx;
+  void *added;
+
+  JX_TRY(jx_vector_append(dest, block->count, &added));
+  memcpy(added, jx_pointer_get(&block->ptr), block->count * isz);
+  return JX_OK;
+}
+
+jx_result jx_pipeline_collect(jx_pipeline *self, jx_vector *dest) {
+  JX_NOT_NULL(dest);
+  assert(dest->isz == jx_pipeline_itemsize(self) &&
+      "Items must be the size of the output.");
+  return run(self, collect_block, dest);
+}
+
+struct reduction {
+  jx_reduce_fn reduce;
+  void *ctx, *result;
+};
+
+static jx_result reduce_block(jx_slice *block, size_t isz, void *ctx) {
+  struct reduction *r = ctx;
+  r->reduce(block, r->result, r->ctx);
+  return JX_OK;
+}
+
+jx_result jx_pipeline_reduce(jx_pipeline *self, jx_reduce_fn reduce,
+    void *ctx, void *result) {
+  struct reduction r;
+
+  JX_NOT_NULL(reduce);
+  r.reduce = reduce;
+  r.ctx = ctx;
+  r.result = result;
+  return run(self, reduce_block, &r);
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static void square(const void *in, void *out, void *ctx) {
+  int64_t v = *(const int*)in;
+  *(int64_t*)out = v*v;
+}
+
+static bool is_odd(const void *item, void *ctx) {
+  return *(const int64_t*)item & 1;
+}
+
+jx_test pipeline_collect() {
+  jx_vector values, squares;
+  jx_pipeline p;
+  int i, *v;
+  int64_t *sq;
+
+  JX_CATCH(jx_vector_init(&values, sizeof(int), 0, NULL));
+  JX_CATCH(jx_vector_append(&values, 100000, &v));
+  for (i = 0; i < 100000; ++i) v[i] = i;
+  JX_CATCH(jx_vector_init(&squares, sizeof(int64_t), 0, NULL));
+
+  /* the odd squares, stopping partway through a block */
+  JX_CATCH(jx_pipeline_init_vector(&p, &values));
+  JX_CATCH(jx_pipeline_map(&p, square, sizeof(int64_t), NULL));
+  JX_CATCH(jx_pipeline_filter(&p, is_odd, NULL));
+  JX_CATCH(jx_pipeline_take(&p, 1500));
+  JX_EXPECT(sizeof(int64_t) == jx_pipeline_itemsize(&p),
+      "The output should be the mapped items.");
+  JX_CATCH(jx_pipeline_collect(&p, &squares));
+
+  JX_EXPECT(1500 == jx_vector_size(&squares), "Take didn't stop the run.");
+  sq = jx_vector_data(&squares);
+  for (i = 0; i < 1500; ++i) {
+    JX_EXPECT((int64_t)(2*i + 1)*(2*i + 1) == sq[i], "Wrong square.");
+  }
+
+  /* running again starts over */
+  jx_vector_clear(&squares);
+  JX_CATCH(jx_pipeline_collect(&p, &squares));
+  JX_EXPECT(1500 == jx_vector_size(&squares), "A second run should match.");
+
+  jx_pipeline_destroy(&p);
+  jx_vector_destroy(&squares);
+  jx_vector_destroy(&values);
+  return JX_PASS;
+}
+
+/* the int64_t is placed after padding, as the compiler lays it out */
+struct pair {
+  int a;
+  int64_t b;
+};
+
+static void dot_product(const jx_slice *part, void *partial, void *ctx) {
+  const struct pair *p = jx_pointer_get(&part->ptr);
+  int64_t *sum = partial;
+  int i;
+
+  for (i = 0; i < part->count; ++i) {
+    *sum += p[i].a * p[i].b;
+  }
+}
+
+jx_test pipeline_zip_reduce() {
+  jx_slice xs, ys, evens, odds;
+  jx_pipeline p;
+  int64_t sum = 0, expect = 0;
+  int i;
+
+  JX_CATCH(jx_slice_init(&xs, sizeof(int), 20000));
+  JX_CATCH(jx_slice_init(&ys, sizeof(int64_t), 14000));
+  for (i = 0; i < 20000; ++i) *(int*)jx_slice_get(&xs, i) = i;
+  for (i = 0; i < 14000; ++i) *(int64_t*)jx_slice_get(&ys, i) = 3 - i;
+
+  /* strided slices, zipped with a shorter one */
+  jx_slice_reslice(&xs, 0, 2, 10000, &evens);
+  jx_slice_reslice(&ys, 1, 2, 7000, &odds);
+  jx_pipeline_init(&p, &evens, sizeof(int));
+  JX_CATCH(jx_pipeline_zip(&p, &odds, sizeof(int64_t),
+        offsetof(struct pair, b), sizeof(struct pair)));
+  JX_EXPECT(sizeof(struct pair) == jx_pipeline_itemsize(&p),
+      "Zipped items should hold both.");
+  JX_CATCH(jx_pipeline_reduce(&p, dot_product, NULL, &sum));
+
+  for (i = 0; i < 7000; ++i) {
+    expect += (int64_t)(2*i) * (3 - (2*i + 1));
+  }
+  JX_EXPECT(expect == sum, "Zip should stop at the shorter slice.");
+
+  jx_pipeline_destroy(&p);
+  jx_slice_destroy(&odds);
+  jx_slice_destroy(&evens);
+  jx_slice_destroy(&ys);
+  jx_slice_destroy(&xs);
+  return JX_PASS;
+}
+
+#endif
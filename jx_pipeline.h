@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_PIPELINE_H
+#define JX_PIPELINE_H
+#include "jinks.h"
+#include "jx_parallel.h"
+
+/* A lazy chain of transformations over a slice. Adding a stage only records
+ * it; running the pipeline pulls the source through every stage a block at
+ * a time, with the blocks sized to stay in cache, straight into a vector or
+ * a reduction. No intermediate vectors are made. */
+
+typedef void (*jx_map_fn)(const void *in, void *out, void *ctx);
+
+typedef bool (*jx_filter_fn)(const void *item, void *ctx);
+
+/* The source is a slice of isz-byte items, which the pipeline clones. */
+void jx_pipeline_init(jx_pipeline *out_self, const jx_slice *source,
+    size_t isz);
+
+/* The source is the items of vector, which the pipeline borrows: the vector
+ * must not change until the pipeline is destroyed.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_pipeline_init_vector(jx_pipeline *out_self,
+    const jx_vector *vector);
+
+void jx_pipeline_destroy(void *pipeline);
+
+/* Size of the items coming out of the last stage. */
+size_t jx_pipeline_itemsize(const jx_pipeline *self);
+
+/******************************************************************************/
+
+/* Stages. Each of these errors with JX_OUT_OF_MEMORY. */
+
+/* Turn every item into an osz-byte item. */
+jx_result jx_pipeline_map(jx_pipeline *self, jx_map_fn fn, size_t osz,
+    void *ctx);
+
+/* Keep the items that fn accepts. */
+jx_result jx_pipeline_filter(jx_pipeline *self, jx_filter_fn fn, void *ctx);
+
+/* Stop after the first count items. */
+jx_result jx_pipeline_take(jx_pipeline *self, int count);
+
+/* Pair each item with the next item of other (of osz bytes). The pairs are
+ * laid out as a struct whose first member is the item and which holds the
+ * item of other at offset at, zsz bytes in all: pass offsetof and sizeof of
+ * the struct the later stages use. Padding is zeroed. Stops when other runs
+ * out. other is cloned. */
+jx_result jx_pipeline_zip(jx_pipeline *self, const jx_slice *other,
+    size_t osz, size_t at, size_t zsz);
+
+/******************************************************************************/
+
+/* Append every item coming out of the pipeline to dest, whose items must be
+ * jx_pipeline_itemsize bytes.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_pipeline_collect(jx_pipeline *self, jx_vector *dest);
+
+/* Feed each block of output (as a slice) to reduce, accumulating in result,
+ * the same reduction that jx_parallel_reduce takes.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_pipeline_reduce(jx_pipeline *self, jx_reduce_fn reduce,
+    void *ctx, void *result);
+
+#endif /* end of header guard */
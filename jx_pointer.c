@@ -7,22 +7,46 @@
 #define VALID(self) \
   JX_NOT_NULL(self); \
   JX_NOT_NULL(self->data); \
-  JX_NOT_NEG(self->data->refs)
+  JX_NOT_NEG(__atomic_load_n(&self->data->refs, __ATOMIC_RELAXED))
 
 jx_result jx_pointer_init(jx_pointer *out_self, size_t sz, 
     jx_destructor destroy) {
+  return jx_pointer_init_aligned(out_self, sz, destroy, 0);
+}
+
+jx_result jx_pointer_init_aligned(jx_pointer *out_self, size_t sz,
+    jx_destructor destroy, size_t align) {
   JX_NOT_NULL(out_self);
   
   out_self->data = malloc(sizeof *out_self->data);
   if (NULL == out_self->data) return JX_OUT_OF_MEMORY;
 
-  out_self->data->item = malloc(sz);
+  out_self->data->item = jx_aligned_alloc(align, sz);
   if (NULL == out_self->data->item) { 
     free(out_self->data); out_self->data = NULL;
     return JX_OUT_OF_MEMORY;
   }
 
+  out_self->data->free_item = true;
   out_self->data->destroy = destroy;
+  out_self->data->release = NULL;
+  out_self->data->owner = NULL;
+  out_self->data->refs = 1;
+  return JX_OK;
+}
+
+jx_result jx_pointer_wrap(jx_pointer *out_self, void *item,
+    jx_destructor destroy) {
+  JX_NOT_NULL(out_self);
+
+  out_self->data = malloc(sizeof *out_self->data);
+  if (NULL == out_self->data) return JX_OUT_OF_MEMORY;
+
+  out_self->data->item = item;
+  out_self->data->free_item = false;
+  out_self->data->destroy = destroy;
+  out_self->data->release = NULL;
+  out_self->data->owner = NULL;
   out_self->data->refs = 1;
   return JX_OK;
 }
@@ -32,22 +56,29 @@ void jx_pointer_clone(const jx_pointer *self, jx_pointer *out_clone) {
 
   /* point to the same data */
   out_clone->data = self->data;
-  /* increment the reference counter */
-  out_clone->data->refs++;
+  /* increment the reference counter. The count is atomic so that clones of
+   * one pointer can be made and destroyed on several threads at once. */
+  __atomic_add_fetch(&out_clone->data->refs, 1, __ATOMIC_RELAXED);
 
   VALID(out_clone);
 }
 
 void jx_pointer_destroy(void *pointer) {
   jx_pointer *self = pointer;
+  int refs;
 
   VALID(self);
+  if (self->data->release) {
+    refs = self->data->release(self->data);
+  } else {
+    refs = __atomic_sub_fetch(&self->data->refs, 1, __ATOMIC_ACQ_REL);
+  }
   /* no more references, clean pointer object. */
-  if (--self->data->refs <= 0) {
+  if (refs <= 0) {
     /* call the destructor */
     jx_destroy(self->data->destroy, self->data->item);
-    /* free the block of memory */
-    free(self->data->item);
+    /* free the block of memory, unless it belongs to someone else */
+    if (self->data->free_item) free(self->data->item);
     memset(self->data, 0, sizeof *self->data);
     free(self->data);
   }
@@ -125,6 +156,21 @@ jx_test pointer_calls_destroy() {
   return JX_PASS;
 }
 
+jx_test pointer_wrap() {
+  int val = 7;
+
+  destroy_calls = 0;
+  JX_CATCH(jx_pointer_wrap(ptr, &val, destroy_int));
+  JX_EXPECT(&val == jx_pointer_get(ptr), "Wrapped the wrong item.");
+  jx_pointer_clone(ptr, ptr2);
+  jx_pointer_destroy(ptr);
+  jx_pointer_destroy(ptr2);
+  JX_EXPECT(1 == destroy_calls && 0 == val,
+      "Destroy wasn't called on the wrapped item.");
+
+  return JX_PASS;
+}
+
 #endif
 
 
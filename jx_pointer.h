@@ -10,6 +10,14 @@
 jx_result jx_pointer_init(jx_pointer *out_self, size_t sz, 
     jx_destructor destroy);
 
+jx_result jx_pointer_init_aligned(jx_pointer *out_self, size_t sz,
+    jx_destructor destroy, size_t align);
+
+/* Share an item that the pointer doesn't own: destroy is still called when
+ * the last reference dies, but the item's memory is not freed. */
+jx_result jx_pointer_wrap(jx_pointer *out_self, void *item,
+    jx_destructor destroy);
+
 void jx_pointer_clone(const jx_pointer *self, jx_pointer *out_clone);
 
 void jx_pointer_destroy(void *pointer);
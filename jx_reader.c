@@ -0,0 +1,432 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include "jx_reader.h"
+#include "jx_pointer.h"
+#include "jx_slice.h"
+#include "jx_vector.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NULL(self->data); \
+  JX_POSITIVE(self->data->isz); \
+  JX_POSITIVE(self->data->batch)
+
+/* size of a batch in bytes when the caller doesn't pick one */
+#define DEFAULT_BATCH_BYTES (1 << 16)
+
+/* one batch being handed out while the next one is read */
+#define NBUFFERS 2
+
+struct buffer {
+  jx_vector records;
+  /* lends the records to the slices handed out */
+  jx_pointer wrap;
+  int count;
+  jx_result err;
+  /* filled by the thread and not yet given back by the caller */
+  bool full;
+};
+
+struct reader_data {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool stop;
+  int fd;
+  bool close_fd;
+  /* reads from fd can block (a pipe or socket): the thread waits in poll
+   * instead, on fd and on wake, which destroy writes to */
+  bool can_block;
+  int wake[2];
+  size_t isz;
+  int batch;
+  /* the next buffer to hand out, and the one handed out last (or -1) */
+  int next, held;
+  struct buffer buffers[NBUFFERS];
+};
+
+/******************************************************************************/
+
+/* Wait until fd has something to read. False if destroy woke the thread
+ * first. */
+static bool wait_readable(struct reader_data *r) {
+  struct pollfd fds[2];
+
+  fds[0].fd = r->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = r->wake[0];
+  fds[1].events = POLLIN;
+  do {
+    fds[0].revents = fds[1].revents = 0;
+  } while (poll(fds, 2, -1) < 0 && EINTR == errno);
+  return 0 == fds[1].revents;
+}
+
+/* Read until the buffer is full or the input ends, so that records split
+ * across reads are put back together. A partial record at the very end is
+ * dropped and reported in out_err. */
+static void fill(struct reader_data *r, struct buffer *b, jx_result *out_err) {
+  unsigned char *data = jx_vector_data(&b->records);
+  size_t total = r->batch * r->isz, bytes = 0;
+  ssize_t n;
+
+  while (bytes < total) {
+    if (r->can_block && !wait_readable(r)) break;
+    n = read(r->fd, data + bytes, total - bytes);
+    if (n < 0 && EINTR == errno) continue;
+    if (n < 0) {
+      *out_err = JX_READ_FAILED;
+      break;
+    }
+    if (0 == n) {
+      if (bytes % r->isz) *out_err = JX_INVALID_FORMAT;
+      break;
+    }
+    bytes += n;
+  }
+  b->count = (int)(bytes / r->isz);
+}
+
+static void* read_ahead(void *arg) {
+  struct reader_data *r = arg;
+  jx_result err = JX_OK;
+  struct buffer *b;
+  bool stop;
+  int i;
+
+  for (i = 0; ; i = (i + 1) % NBUFFERS) {
+    b = &r->buffers[i];
+    pthread_mutex_lock(&r->lock);
+    while (b->full && !r->stop) {
+      pthread_cond_wait(&r->changed, &r->lock);
+    }
+    stop = r->stop;
+    pthread_mutex_unlock(&r->lock);
+    if (stop) break;
+
+    /* a pending error goes out in a batch of its own, after the records */
+    b->count = 0;
+    if (JX_OK == err) fill(r, b, &err);
+    b->err = (b->count ? JX_OK : err);
+
+    pthread_mutex_lock(&r->lock);
+    b->full = true;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    /* the end of the input, or an error: the caller keeps getting this */
+    if (0 == b->count) break;
+  }
+  return NULL;
+}
+
+/******************************************************************************/
+
+/* release the first 'ready' buffers and the reader itself. */
+static void free_reader(struct reader_data *r, int ready) {
+  int i;
+
+  for (i = 0; i < ready; ++i) {
+    jx_pointer_destroy(&r->buffers[i].wrap);
+    jx_vector_destroy(&r->buffers[i].records);
+  }
+  pthread_cond_destroy(&r->changed);
+  pthread_mutex_destroy(&r->lock);
+  if (r->can_block) {
+    close(r->wake[0]);
+    close(r->wake[1]);
+  }
+  if (r->close_fd) close(r->fd);
+  free(r);
+}
+
+jx_result jx_reader_init(jx_reader *out_self, int fd, size_t isz, int batch) {
+  struct reader_data *r;
+  struct buffer *b;
+  struct stat st;
+  int i;
+
+  JX_NOT_NULL(out_self);
+  JX_NOT_NEG(fd);
+  JX_POSITIVE(isz);
+  JX_NOT_NEG(batch);
+
+  if (0 == batch) batch = (int)(DEFAULT_BATCH_BYTES / isz);
+  if (batch < 1) batch = 1;
+
+  r = malloc(sizeof *r);
+  if (NULL == r) return JX_OUT_OF_MEMORY;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->changed, NULL);
+  r->stop = false;
+  r->fd = fd;
+  r->close_fd = false;
+  /* regular files always poll as readable, so they skip it */
+  r->can_block = !(0 == fstat(fd, &st) && S_ISREG(st.st_mode));
+  if (r->can_block && 0 != pipe(r->wake)) {
+    r->can_block = false;
+    free_reader(r, 0);
+    return JX_OUT_OF_MEMORY;
+  }
+  r->isz = isz;
+  r->batch = batch;
+  r->next = 0;
+  r->held = -1;
+
+  for (i = 0; i < NBUFFERS; ++i) {
+    b = &r->buffers[i];
+    /* the buffers never grow, so the wrapped data pointer stays put */
+    if (JX_OK != jx_vector_init_aligned(&b->records, isz, batch, NULL,
+          JX_CACHE_LINE)) {
+      break;
+    }
+    jx_vector_append(&b->records, batch, NULL);
+    if (JX_OK != jx_pointer_wrap(&b->wrap, jx_vector_data(&b->records),
+          NULL)) {
+      jx_vector_destroy(&b->records);
+      break;
+    }
+    b->count = 0;
+    b->err = JX_OK;
+    b->full = false;
+  }
+  if (i < NBUFFERS) {
+    free_reader(r, i);
+    return JX_OUT_OF_MEMORY;
+  }
+
+  /* let the kernel read ahead aggressively too; pipes just ignore this */
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (0 != pthread_create(&r->thread, NULL, read_ahead, r)) {
+    free_reader(r, NBUFFERS);
+    return JX_OUT_OF_MEMORY;
+  }
+
+  out_self->data = r;
+  VALID(out_self);
+  return JX_OK;
+}
+
+jx_result jx_reader_open(jx_reader *out_self, const char *path, size_t isz,
+    int batch) {
+  jx_result err;
+  int fd;
+
+  JX_NOT_NULL(path);
+
+  do {
+    fd = open(path, O_RDONLY);
+  } while (fd < 0 && EINTR == errno);
+  if (fd < 0) return JX_CANNOT_OPEN_FILE;
+
+  err = jx_reader_init(out_self, fd, isz, batch);
+  if (JX_OK != err) {
+    close(fd);
+    return err;
+  }
+  out_self->data->close_fd = true;
+  return JX_OK;
+}
+
+void jx_reader_destroy(void *reader) {
+  jx_reader *self = reader;
+  struct reader_data *r;
+  VALID(self);
+
+  r = self->data;
+  pthread_mutex_lock(&r->lock);
+  r->stop = true;
+  pthread_cond_broadcast(&r->changed);
+  pthread_mutex_unlock(&r->lock);
+  /* and wake it if it is waiting for input */
+  if (r->can_block) {
+    while (write(r->wake[1], "", 1) < 0 && EINTR == errno);
+  }
+  pthread_join(r->thread, NULL);
+
+  free_reader(r, NBUFFERS);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+jx_result jx_reader_next(jx_reader *self, jx_slice *out_batch) {
+  struct reader_data *r;
+  struct buffer *b;
+  jx_result err;
+
+  VALID(self);
+  JX_NOT_NULL(out_batch);
+
+  r = self->data;
+  pthread_mutex_lock(&r->lock);
+  /* the caller is done with the last batch, it can be refilled */
+  if (r->held >= 0) {
+    r->buffers[r->held].full = false;
+    r->held = -1;
+    pthread_cond_broadcast(&r->changed);
+  }
+  b = &r->buffers[r->next];
+  while (!b->full) {
+    pthread_cond_wait(&r->changed, &r->lock);
+  }
+  /* an empty or failed batch is the last one, it is never given back */
+  if (b->count > 0) {
+    r->held = r->next;
+    r->next = (r->next + 1) % NBUFFERS;
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  err = b->err;
+  if (JX_OK == err) {
+    jx_pointer_clone(&b->wrap, &out_batch->ptr);
+    out_batch->start = 0;
+    out_batch->stride = r->isz;
+    out_batch->count = b->count;
+  }
+  return err;
+}
+
+size_t jx_reader_itemsize(const jx_reader *self) {
+  VALID(self);
+  return self->data->isz;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+struct sample {
+  uint32_t id;
+  uint16_t channel;
+  uint16_t flags;
+  double value;
+  float weight;
+};
+
+static jx_reader reader_var, *reader = &reader_var;
+
+static void make_sample(struct sample *s, int i) {
+  memset(s, 0, sizeof *s);
+  s->id = i;
+  s->channel = (uint16_t)(i % 7);
+  s->value = i * 0.5;
+  s->weight = -i;
+}
+
+/* read every batch, checking that the records arrive in order. */
+static jx_test read_all(int expected, int batch, jx_result last) {
+  struct sample want, *got;
+  jx_slice part;
+  jx_result err;
+  int i, seen = 0;
+
+  for (;;) {
+    err = jx_reader_next(reader, &part);
+    if (JX_OK != err) break;
+    JX_EXPECT(jx_slice_count(&part) <= batch, "A batch is too large.");
+    if (0 == jx_slice_count(&part)) {
+      jx_slice_destroy(&part);
+      break;
+    }
+    for (i = 0; i < jx_slice_count(&part); ++i, ++seen) {
+      got = jx_slice_get(&part, i);
+      make_sample(&want, seen);
+      JX_EXPECT(0 == memcmp(&want, got, sizeof want),
+          "A record was read incorrectly.");
+    }
+    jx_slice_destroy(&part);
+  }
+  JX_EXPECT(expected == seen, "Incorrect number of records.");
+  JX_EXPECT(last == err, "Incorrect result at the end of the input.");
+  JX_EXPECT(last == jx_reader_next(reader, &part),
+      "The end of the input should be sticky.");
+  if (JX_OK == last) jx_slice_destroy(&part);
+  return JX_PASS;
+}
+
+jx_test reader_file() {
+  char path[] = "/tmp/jx_reader_XXXXXX";
+  struct sample s;
+  jx_test result;
+  int i, fd;
+
+  fd = mkstemp(path);
+  JX_EXPECT(fd >= 0, "Couldn't create a temporary file.");
+  for (i = 0; i < 1000; ++i) {
+    make_sample(&s, i);
+    JX_EXPECT(sizeof s == write(fd, &s, sizeof s), "Couldn't write.");
+  }
+
+  JX_CATCH(jx_reader_open(reader, path, sizeof s, 64));
+  JX_EXPECT(sizeof s == jx_reader_itemsize(reader), "Incorrect item size.");
+  result = read_all(1000, 64, JX_OK);
+  jx_reader_destroy(reader);
+  if (result.file) return result;
+
+  /* half a record at the end */
+  JX_EXPECT(5 == write(fd, &s, 5), "Couldn't write.");
+  JX_CATCH(jx_reader_open(reader, path, sizeof s, 0));
+  result = read_all(1000, 1000000, JX_INVALID_FORMAT);
+  jx_reader_destroy(reader);
+
+  close(fd);
+  unlink(path);
+  JX_EXPECT(JX_CANNOT_OPEN_FILE == jx_reader_open(reader, path, sizeof s, 0),
+      "Opened a missing file.");
+  return result;
+}
+
+/* dribble records into a pipe a few bytes at a time */
+static void* write_pipe(void *arg) {
+  int fd = *(int*)arg, i;
+  struct sample s;
+  unsigned char *bytes = (unsigned char*)&s;
+  size_t k;
+  ssize_t n = 0;
+
+  for (i = 0; n >= 0 && i < 500; ++i) {
+    make_sample(&s, i);
+    for (k = 0; n >= 0 && k < sizeof s; k += n) {
+      n = write(fd, bytes + k, (sizeof s - k < 7 ? sizeof s - k : 7));
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+jx_test reader_pipe() {
+  pthread_t writer;
+  jx_test result;
+  int fds[2];
+
+  JX_EXPECT(0 == pipe(fds), "Couldn't create a pipe.");
+  JX_CATCH(jx_reader_init(reader, fds[0], sizeof(struct sample), 10));
+  JX_EXPECT(0 == pthread_create(&writer, NULL, write_pipe, &fds[1]),
+      "Couldn't start the writer.");
+
+  result = read_all(500, 10, JX_OK);
+  pthread_join(writer, NULL);
+  jx_reader_destroy(reader);
+  close(fds[0]);
+  if (result.file) return result;
+
+  /* destroying a reader waiting on a pipe that stays open and idle */
+  JX_EXPECT(0 == pipe(fds), "Couldn't create a pipe.");
+  JX_CATCH(jx_reader_init(reader, fds[0], sizeof(struct sample), 10));
+  jx_reader_destroy(reader);
+  close(fds[0]);
+  close(fds[1]);
+  return JX_PASS;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_READER_H
+#define JX_READER_H
+#include "jinks.h"
+
+/* Streams fixed-size records from a file descriptor in batches. A background
+ * thread reads the next batch while the caller works on the current one, so
+ * reading and processing overlap. Records that arrive split across reads
+ * (from a pipe or socket, say) are put back together. */
+
+/* Read records of isz bytes from fd, batch records at a time (0 picks a
+ * size of about 64KiB). The reader doesn't close fd.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_reader_init(jx_reader *out_self, int fd, size_t isz, int batch);
+
+/* Same as jx_reader_init, for the file at path. This reader closes the file.
+ *
+ * Errors: JX_OUT_OF_MEMORY, JX_CANNOT_OPEN_FILE */
+jx_result jx_reader_open(jx_reader *out_self, const char *path, size_t isz,
+    int batch);
+
+/* Stops the read-ahead thread, waking it if it is waiting for input on a
+ * pipe or socket. */
+void jx_reader_destroy(void *reader);
+
+/******************************************************************************/
+
+/* Hand out the next batch as a slice of records. The slice must be destroyed
+ * (jx_slice_destroy), and its items are only valid until the next call to
+ * jx_reader_next or jx_reader_destroy, when the buffer goes back to the
+ * read-ahead thread. An empty batch means the end of the input; errors are
+ * reported after every complete record before them has been handed out, and
+ * keep being reported by later calls.
+ *
+ * Errors: JX_READ_FAILED, JX_INVALID_FORMAT (the input ended part way
+ * through a record) */
+jx_result jx_reader_next(jx_reader *self, jx_slice *out_batch);
+
+size_t jx_reader_itemsize(const jx_reader *self);
+
+#endif /* end of header guard */
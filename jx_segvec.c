@@ -0,0 +1,238 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_segvec.h"
+#include "jx_vector.h"
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_NOT_NEG(self->size); \
+  JX_POSITIVE(self->isz); \
+  JX_RANGE(self->shift, 0, 31)
+
+/* target size of a chunk in bytes when the caller doesn't pick one */
+#define DEFAULT_CHUNK_BYTES 4096
+
+#define CHUNK_ITEMS(self) (1 << (self)->shift)
+#define CHUNK_BYTES(self) ((size_t)CHUNK_ITEMS(self) * (self)->isz)
+
+jx_result jx_segvec_init(jx_segvec *out_self, size_t isz, int chunk,
+    jx_destructor destroy) {
+  JX_NOT_NULL(out_self);
+  JX_POSITIVE(isz);
+  JX_NOT_NEG(chunk);
+
+  if (0 == chunk) chunk = (int)(DEFAULT_CHUNK_BYTES / isz);
+  out_self->shift = 0;
+  while ((1 << out_self->shift) < chunk) out_self->shift++;
+
+  out_self->destroy = destroy;
+  out_self->isz = isz;
+  out_self->size = 0;
+  VALID(out_self);
+
+  return jx_vector_init(&out_self->chunks, sizeof(unsigned char*), 0, NULL);
+}
+
+void jx_segvec_destroy(void *segvec) {
+  jx_segvec *self = segvec;
+  VALID(self);
+
+  jx_segvec_clear(self);
+  jx_segvec_shrink(self);
+  jx_vector_destroy(&self->chunks);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+bool jx_segvec_isempty(const jx_segvec *self) {
+  VALID(self);
+  return !self->size;
+}
+
+int jx_segvec_size(const jx_segvec *self) {
+  VALID(self);
+  return self->size;
+}
+
+int jx_segvec_capacity(const jx_segvec *self) {
+  VALID(self);
+  return jx_vector_size(&self->chunks) << self->shift;
+}
+
+jx_result jx_segvec_reserve(jx_segvec *self, int num) {
+  unsigned char *chunk;
+  int have, need;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+
+  have = jx_vector_size(&self->chunks);
+  need = (num + CHUNK_ITEMS(self) - 1) >> self->shift;
+  if (need <= have) return JX_OK;
+
+  /* only the directory is reallocated, existing chunks stay put */
+  JX_TRY(jx_vector_reserve(&self->chunks, need));
+  for (; have < need; ++have) {
+    chunk = jx_aligned_alloc(JX_CACHE_LINE, CHUNK_BYTES(self));
+    if (NULL == chunk) return JX_OUT_OF_MEMORY;
+    /* reserved above, this won't fail */
+    jx_vector_append(&self->chunks, 1, NULL);
+    *(unsigned char**)jx_vector_back(&self->chunks) = chunk;
+  }
+  return JX_OK;
+}
+
+void jx_segvec_shrink(jx_segvec *self) {
+  int keep;
+
+  VALID(self);
+
+  keep = (self->size + CHUNK_ITEMS(self) - 1) >> self->shift;
+  while (jx_vector_size(&self->chunks) > keep) {
+    free(*(unsigned char**)jx_vector_back(&self->chunks));
+    jx_vector_pop_back(&self->chunks, 1);
+  }
+}
+
+/******************************************************************************/
+
+static unsigned char* item_at(const jx_segvec *self, int i) {
+  unsigned char **chunks = jx_vector_data(&self->chunks);
+  return &chunks[i >> self->shift][(i & (CHUNK_ITEMS(self) - 1)) * self->isz];
+}
+
+void* jx_segvec_at(const jx_segvec *self, int i) {
+  VALID(self);
+  JX_RANGE(i, -self->size, self->size);
+
+  i = (i >= 0 ? i : self->size + i);
+  return item_at(self, i);
+}
+
+void* jx_segvec_front(const jx_segvec *self) {
+  return jx_segvec_at(self, 0);
+}
+
+void* jx_segvec_back(const jx_segvec *self) {
+  return jx_segvec_at(self, -1);
+}
+
+void* jx_segvec_run(const jx_segvec *self, int i, int *out_count) {
+  int left;
+
+  VALID(self);
+  JX_RANGE(i, 0, self->size);
+  JX_NOT_NULL(out_count);
+
+  left = CHUNK_ITEMS(self) - (i & (CHUNK_ITEMS(self) - 1));
+  *out_count = (left < self->size - i ? left : self->size - i);
+  return item_at(self, i);
+}
+
+/******************************************************************************/
+
+jx_result jx_segvec_append(jx_segvec *self, int num, jx_outptr out_ptr) {
+  VALID(self);
+  JX_POSITIVE(num);
+
+  JX_TRY(jx_segvec_reserve(self, self->size + num));
+  JX_SET(out_ptr, item_at(self, self->size));
+  self->size += num;
+  return JX_OK;
+}
+
+void jx_segvec_pop_back(jx_segvec *self, int num) {
+  unsigned char *items;
+  int i, count;
+
+  VALID(self);
+  JX_RANGE(num, 0, self->size+1);
+
+  for (i = self->size - num; i < self->size; i += count) {
+    items = jx_segvec_run(self, i, &count);
+    jx_destroy_range(self->destroy, count, self->isz, items);
+  }
+  self->size -= num;
+}
+
+void jx_segvec_clear(jx_segvec *self) {
+  jx_segvec_pop_back(self, jx_segvec_size(self));
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_segvec segvec_var, *segvec = &segvec_var;
+
+jx_test segvec_stable_pointers() {
+  int i, *val, *first, *firsts[3];
+
+  JX_CATCH(jx_segvec_init(segvec, sizeof(int), 10, NULL));
+  JX_EXPECT(jx_segvec_isempty(segvec), "A new segmented vector is empty.");
+
+  JX_CATCH(jx_segvec_append(segvec, 1, &first));
+  *first = 0;
+  for (i = 1; i < 1000; ++i) {
+    JX_CATCH(jx_segvec_append(segvec, 1, &val));
+    *val = i;
+    if (i < 3) firsts[i] = val;
+  }
+
+  JX_EXPECT(1000 == jx_segvec_size(segvec), "Incorrect size.");
+  JX_EXPECT(first == jx_segvec_front(segvec) && firsts[2] ==
+      jx_segvec_at(segvec, 2), "Growing moved existing items.");
+  JX_EXPECT(999 == *(int*)jx_segvec_back(segvec), "Incorrect last item.");
+  for (i = 0; i < 1000; ++i) {
+    JX_EXPECT(i == *(int*)jx_segvec_at(segvec, i), "Incorrect contents.");
+  }
+
+  jx_segvec_pop_back(segvec, 990);
+  jx_segvec_shrink(segvec);
+  JX_EXPECT(16 == jx_segvec_capacity(segvec),
+      "Shrinking should keep only the chunk in use.");
+  JX_EXPECT(first == jx_segvec_front(segvec), "Shrinking moved an item.");
+
+  jx_segvec_destroy(segvec);
+  return JX_PASS;
+}
+
+static int destroyed;
+
+static void count_destroy(void *item) {
+  destroyed += *(int*)item;
+}
+
+jx_test segvec_runs() {
+  int i, count, runs, sum, *vals;
+
+  JX_CATCH(jx_segvec_init(segvec, sizeof(int), 8, count_destroy));
+  JX_CATCH(jx_segvec_append(segvec, 5, NULL));
+  JX_CATCH(jx_segvec_append(segvec, 30, NULL));
+  for (i = 0; i < 35; ++i) {
+    *(int*)jx_segvec_at(segvec, i) = i;
+  }
+
+  /* 35 items in chunks of 8, starting part way in: 3..7, 8..15, ... */
+  for (i = 3, runs = 0, sum = 0; i < 35; i += count, ++runs) {
+    vals = jx_segvec_run(segvec, i, &count);
+    JX_EXPECT(vals[0] == i, "A run starts at the wrong item.");
+    sum += vals[count-1];
+  }
+  JX_EXPECT(5 == runs, "Incorrect number of runs.");
+  JX_EXPECT(7 + 15 + 23 + 31 + 34 == sum, "Runs end at the wrong items.");
+
+  destroyed = 0;
+  jx_segvec_pop_back(segvec, 10);
+  JX_EXPECT(25+26+27+28+29+30+31+32+33+34 == destroyed,
+      "Destroy wasn't called on the popped items.");
+  jx_segvec_destroy(segvec);
+  JX_EXPECT(35*34/2 == destroyed, "Destroy wasn't called on every item.");
+  return JX_PASS;
+}
+
+#endif
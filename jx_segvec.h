@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_SEGVEC_H
+#define JX_SEGVEC_H
+#include "jinks.h"
+
+/* A segmented vector: items live in fixed size chunks (a power of two items
+ * each) found through a directory of chunks. Growing only adds chunks, so
+ * items never move and pointers to them stay valid until the item is
+ * removed. Only the end of the vector can grow or shrink. */
+
+/* chunk is the number of items per chunk, rounded up to a power of two, or 0
+ * for a default of about a page. */
+jx_result jx_segvec_init(jx_segvec *out_self, size_t isz, int chunk,
+    jx_destructor destroy);
+
+void jx_segvec_destroy(void *segvec);
+
+/******************************************************************************/
+
+bool jx_segvec_isempty(const jx_segvec *self);
+
+int jx_segvec_size(const jx_segvec *self);
+
+int jx_segvec_capacity(const jx_segvec *self);
+
+jx_result jx_segvec_reserve(jx_segvec *self, int num);
+
+/* Release the chunks past the last item. */
+void jx_segvec_shrink(jx_segvec *self);
+
+/******************************************************************************/
+
+void* jx_segvec_at(const jx_segvec *self, int i);
+
+void* jx_segvec_front(const jx_segvec *self);
+
+void* jx_segvec_back(const jx_segvec *self);
+
+/* Item i and, in out_count, the number of items stored contiguously from it
+ * (to the end of its chunk or of the vector). Walks a chunk at a time:
+ *   for (i = 0; i < size; i += count) { item = jx_segvec_run(sv, i, &count);
+ *   ... } */
+void* jx_segvec_run(const jx_segvec *self, int i, int *out_count);
+
+/******************************************************************************/
+
+/* Adds num items; out_ptr gets the first of them. The new items are only
+ * contiguous up to the end of a chunk, see jx_segvec_run. */
+jx_result jx_segvec_append(jx_segvec *self, int num, jx_outptr out_ptr);
+
+void jx_segvec_pop_back(jx_segvec *self, int num);
+
+void jx_segvec_clear(jx_segvec *self);
+
+#endif /* end of header guard */
@@ -5,12 +5,22 @@
  ******************************************************************************/
 #include "jx_slice.h"
 #include "jx_pointer.h"
+#include "jx_vector.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #define VALID(self) \
   JX_NOT_NULL(self); \
   JX_NOT_NEG(self->count)
 
 jx_result jx_slice_init(jx_slice *out_self, size_t itemsize, int count) {
+  return jx_slice_init_aligned(out_self, itemsize, count, 0);
+}
+
+jx_result jx_slice_init_aligned(jx_slice *out_self, size_t itemsize, int count,
+    size_t align) {
   JX_NOT_NULL(out_self);
   JX_POSITIVE(itemsize);
   JX_NOT_NEG(count);
@@ -18,7 +28,8 @@ jx_result jx_slice_init(jx_slice *out_self, size_t itemsize, int count) {
   out_self->start = 0;
   out_self->stride = itemsize;
   out_self->count = count;
-  JX_TRY(jx_pointer_init(&out_self->ptr, itemsize*count, NULL));
+  JX_TRY(jx_pointer_init_aligned(&out_self->ptr, itemsize*count, NULL,
+        align));
   VALID(out_self);
 
   return JX_OK;
@@ -78,6 +89,165 @@ void jx_slice_reslice(const jx_slice *self, int start, int step, int count,
   VALID(out_slice);
 }
 
+/******************************************************************************/
+
+/* Copy count items between two strided arrays. The common item sizes get
+ * their own loops so that each memcpy compiles to a single move. */
+static void copy_strided(unsigned char *dst, int dstride,
+    const unsigned char *src, int sstride, int count, size_t isz) {
+  int i;
+
+#define COPY_LOOP(n) \
+  for (i = 0; i < count; ++i, dst += dstride, src += sstride) \
+    memcpy(dst, src, n)
+
+  if (dstride == (int)isz && sstride == (int)isz) {
+    memcpy(dst, src, count*isz);
+    return;
+  }
+  switch (isz) {
+    case 4: COPY_LOOP(4); break;
+    case 8: COPY_LOOP(8); break;
+    case 16: COPY_LOOP(16); break;
+    default: COPY_LOOP(isz); break;
+  }
+#undef COPY_LOOP
+}
+
+static void copy_item(unsigned char *dst, const unsigned char *src,
+    size_t isz) {
+  switch (isz) {
+    case 4: memcpy(dst, src, 4); break;
+    case 8: memcpy(dst, src, 8); break;
+    case 16: memcpy(dst, src, 16); break;
+    default: memcpy(dst, src, isz); break;
+  }
+}
+
+#ifdef __AVX2__
+/* Hardware gathers for packing 4 and 8 byte items: byte offsets of each
+ * lane are computed from the indices (or from the stride), and the loaded
+ * lanes are stored densely. Returns the number of items handled, the caller
+ * finishes the tail. */
+static int simd_gather(unsigned char *dst, const unsigned char *base,
+    int stride, const int *idx, int count, size_t isz) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i vstride = _mm256_set1_epi32(stride);
+  int i = 0;
+
+  if (4 == isz) {
+    for (; i + 8 <= count; i += 8) {
+      __m256i offs = idx ? _mm256_loadu_si256((const __m256i*)&idx[i])
+        : _mm256_add_epi32(lanes, _mm256_set1_epi32(i));
+      offs = _mm256_mullo_epi32(offs, vstride);
+      _mm256_storeu_si256((__m256i*)&dst[i*4],
+          _mm256_i32gather_epi32((const int*)base, offs, 1));
+    }
+  } else if (8 == isz) {
+    for (; i + 4 <= count; i += 4) {
+      __m128i offs4 = idx ? _mm_loadu_si128((const __m128i*)&idx[i])
+        : _mm_add_epi32(_mm256_castsi256_si128(lanes), _mm_set1_epi32(i));
+      offs4 = _mm_mullo_epi32(offs4, _mm256_castsi256_si128(vstride));
+      _mm256_storeu_si256((__m256i*)&dst[i*8],
+          _mm256_i32gather_epi64((const long long*)base, offs4, 1));
+    }
+  }
+  return i;
+}
+#endif
+
+void jx_slice_copy_to(const jx_slice *self, size_t isz, void *dest) {
+  unsigned char *dst = dest;
+  const unsigned char *src;
+  int done = 0;
+
+  VALID(self);
+  JX_POSITIVE(isz);
+  JX_ARRAY_SZ(self->count, dest);
+
+  if (0 == self->count) return;
+  src = jx_slice_get(self, 0);
+#ifdef __AVX2__
+  if (self->stride != (int)isz) {
+    done = simd_gather(dst, src, self->stride, NULL, self->count, isz);
+  }
+#endif
+  copy_strided(&dst[done*isz], isz, &src[done*self->stride], self->stride,
+      self->count - done, isz);
+}
+
+jx_result jx_slice_compact(const jx_slice *self, size_t isz,
+    jx_slice *out_slice) {
+  VALID(self);
+  JX_NOT_NULL(out_slice);
+
+  JX_TRY(jx_slice_init(out_slice, isz, self->count));
+  jx_slice_copy_to(self, isz, jx_pointer_get(&out_slice->ptr));
+  return JX_OK;
+}
+
+void jx_slice_gather(const jx_slice *self, size_t isz,
+    const jx_vector *indices, jx_slice *dest) {
+  const int *idx;
+  const unsigned char *base;
+  unsigned char *dst;
+  int i = 0, n;
+
+  VALID(self);
+  VALID(dest);
+  JX_POSITIVE(isz);
+  JX_NOT_NULL(indices);
+  assert(sizeof(int) == indices->isz && "Indices must be a vector of int.");
+
+  n = jx_vector_size(indices);
+  assert(n <= dest->count && "Destination slice is too small.");
+  if (0 == n) return;
+
+  idx = jx_vector_data(indices);
+  base = (unsigned char*)jx_pointer_get(&self->ptr) + self->start;
+  dst = jx_slice_get(dest, 0);
+#ifdef __AVX2__
+  if (dest->stride == (int)isz) {
+    for (i = 0; i < n; ++i) {
+      JX_RANGE(idx[i], 0, self->count);
+    }
+    i = simd_gather(dst, base, self->stride, idx, n, isz);
+  }
+#endif
+  for (dst += i*dest->stride; i < n; ++i, dst += dest->stride) {
+    JX_RANGE(idx[i], 0, self->count);
+    copy_item(dst, &base[idx[i]*self->stride], isz);
+  }
+}
+
+void jx_slice_scatter(const jx_slice *self, size_t isz,
+    const jx_vector *indices, jx_slice *dest) {
+  const int *idx;
+  const unsigned char *src;
+  unsigned char *base;
+  int i, n;
+
+  VALID(self);
+  VALID(dest);
+  JX_POSITIVE(isz);
+  JX_NOT_NULL(indices);
+  assert(sizeof(int) == indices->isz && "Indices must be a vector of int.");
+
+  n = jx_vector_size(indices);
+  assert(n <= self->count && "Source slice is too small.");
+  if (0 == n) return;
+
+  idx = jx_vector_data(indices);
+  base = (unsigned char*)jx_pointer_get(&dest->ptr) + dest->start;
+  src = jx_slice_get(self, 0);
+  for (i = 0; i < n; ++i, src += self->stride) {
+    JX_RANGE(idx[i], 0, dest->count);
+    copy_item(&base[idx[i]*dest->stride], src, isz);
+  }
+}
+
+/******************************************************************************/
+
 #ifdef JX_TESTING
 
 static jx_slice slice_var, *slice = &slice_var;
@@ -137,6 +307,69 @@ jx_test slice_operations() {
   return JX_PASS;
 }
 
-#endif
+jx_test slice_compact() {
+  int i, *vals;
+
+  JX_CATCH(jx_slice_init(slice, sizeof(int), 50));
+  for (i = 0; i < 50; ++i) {
+    *(int*)jx_slice_get(slice, i) = i;
+  }
+
+  /* 49, 46, ..., 1 */
+  jx_slice_reslice(slice, -1, -3, 50, slice2);
+  jx_slice_destroy(slice);
+  JX_CATCH(jx_slice_compact(slice2, sizeof(int), slice));
+  JX_EXPECT(17 == jx_slice_count(slice), "Compacted slice has wrong count.");
+  jx_slice_destroy(slice2);
+
+  vals = jx_slice_get(slice, 0);
+  for (i = 0; i < 17; ++i) {
+    JX_EXPECT(49 - 3*i == vals[i], "Compacted slice has wrong contents.");
+  }
 
+  jx_slice_destroy(slice);
+  return JX_PASS;
+}
+
+jx_test slice_gather_scatter() {
+  jx_vector indices;
+  int i, *idx;
+  double *val;
+
+  JX_CATCH(jx_slice_init(slice, sizeof(double), 20));
+  for (i = 0; i < 20; ++i) {
+    *(double*)jx_slice_get(slice, i) = i + 0.5;
+  }
+
+  JX_CATCH(jx_vector_init(&indices, sizeof(int), 0, NULL));
+  JX_CATCH(jx_vector_append(&indices, 11, &idx));
+  for (i = 0; i < 10; ++i) {
+    idx[i] = (3*i) % 10;
+  }
+  idx[10] = 9;
 
+  /* gather the odd items (through a stride 2 view) in a shuffled order */
+  jx_slice_reslice(slice, 1, 2, 10, slice2);
+  jx_slice_destroy(slice);
+  JX_CATCH(jx_slice_init(slice, sizeof(double), 11));
+  jx_slice_gather(slice2, sizeof(double), &indices, slice);
+  for (i = 0; i < 11; ++i) {
+    val = jx_slice_get(slice, i);
+    JX_EXPECT(2*idx[i] + 1.5 == *val, "Gathered the wrong items.");
+  }
+
+  /* scatter them back, the repeated index writes the same value twice */
+  memset(jx_pointer_get(&slice2->ptr), 0, 20*sizeof(double));
+  jx_slice_scatter(slice, sizeof(double), &indices, slice2);
+  for (i = 0; i < 10; ++i) {
+    val = jx_slice_get(slice2, i);
+    JX_EXPECT(2*i + 1.5 == *val, "Scattered the items to the wrong spots.");
+  }
+
+  jx_vector_destroy(&indices);
+  jx_slice_destroy(slice);
+  jx_slice_destroy(slice2);
+  return JX_PASS;
+}
+
+#endif
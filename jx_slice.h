@@ -9,6 +9,9 @@
 
 jx_result jx_slice_init(jx_slice *out_self, size_t itemsize, int count);
 
+jx_result jx_slice_init_aligned(jx_slice *out_self, size_t itemsize, int count,
+    size_t align);
+
 void jx_slice_destroy(void *slice);
 
 int jx_slice_count(const jx_slice *self);
@@ -18,5 +21,21 @@ void* jx_slice_get(const jx_slice *self, int i);
 void jx_slice_reslice(const jx_slice *self, int start, int step, int count,
     jx_slice *out_slice);
 
+/******************************************************************************/
+
+/* Slices don't record the size of their items (the stride may be any
+ * multiple of it), so the functions below take it as isz. */
+
+void jx_slice_copy_to(const jx_slice *self, size_t isz, void *dest);
+
+jx_result jx_slice_compact(const jx_slice *self, size_t isz,
+    jx_slice *out_slice);
+
+void jx_slice_gather(const jx_slice *self, size_t isz,
+    const jx_vector *indices, jx_slice *dest);
+
+void jx_slice_scatter(const jx_slice *self, size_t isz,
+    const jx_vector *indices, jx_slice *dest);
+
 #endif /* end of header guard */
 
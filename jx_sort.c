@@ -0,0 +1,293 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_sort.h"
+#include "jx_vector.h"
+#include <stddef.h>
+
+/* byte b of a key, counting from the least significant */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define KEY_BYTE(offset, width, b) ((offset) + (width) - 1 - (b))
+#else
+#define KEY_BYTE(offset, width, b) ((offset) + (b))
+#endif
+
+/* runs shorter than this are insertion sorted before merging */
+#define SMALL_RUN 16
+
+/******************************************************************************/
+
+/* One counting pass: move every item of src to its bucket in dst. pos holds
+ * the first free slot of each bucket. The usual item sizes get their own
+ * loop so the copy is a single move. */
+static void scatter_pass(unsigned char *dst, const unsigned char *src, int n,
+    size_t isz, size_t kb, size_t *pos) {
+  const unsigned char *end = src + n*isz;
+
+#define SCATTER_LOOP(sz) \
+  for (; src < end; src += sz) \
+    memcpy(&dst[pos[src[kb]]++ * sz], src, sz)
+
+  switch (isz) {
+    case 4: SCATTER_LOOP(4); break;
+    case 8: SCATTER_LOOP(8); break;
+    case 16: SCATTER_LOOP(16); break;
+    default: SCATTER_LOOP(isz); break;
+  }
+#undef SCATTER_LOOP
+}
+
+static jx_result radix_sort(unsigned char *data, int n, size_t isz,
+    size_t offset, size_t width) {
+  size_t counts[8][256], pos[256], sum;
+  unsigned char *scratch, *src, *dst, *tmp, *item;
+  size_t b, kb;
+  int i, k;
+
+  if (n < 2) return JX_OK;
+  scratch = malloc(n*isz);
+  if (NULL == scratch) return JX_OUT_OF_MEMORY;
+
+  /* count every key byte in a single sweep over the data */
+  memset(counts, 0, sizeof counts);
+  for (i = 0, item = data; i < n; ++i, item += isz) {
+    for (b = 0; b < width; ++b) {
+      counts[b][item[KEY_BYTE(offset, width, b)]]++;
+    }
+  }
+
+  src = data;
+  dst = scratch;
+  for (b = 0; b < width; ++b) {
+    kb = KEY_BYTE(offset, width, b);
+    /* all the items share this byte, the pass wouldn't change anything */
+    if (counts[b][src[kb]] == (size_t)n) continue;
+
+    for (k = 0, sum = 0; k < 256; ++k) {
+      pos[k] = sum;
+      sum += counts[b][k];
+    }
+    scatter_pass(dst, src, n, isz, kb, pos);
+    tmp = src; src = dst; dst = tmp;
+  }
+
+  if (src != data) memcpy(data, src, n*isz);
+  free(scratch);
+  return JX_OK;
+}
+
+jx_result jx_vector_radix_sort(jx_vector *self, size_t offset, size_t width) {
+  JX_NOT_NULL(self);
+  JX_RANGE(width, 1, 9);
+  assert(offset + width <= self->isz && "The key doesn't fit in the item.");
+
+  return radix_sort(jx_vector_data(self), jx_vector_size(self), self->isz,
+      offset, width);
+}
+
+jx_result jx_vector_radix_sort_by(jx_vector *self, jx_key_fn key) {
+  unsigned char *tagged, *item, *data;
+  size_t tsz;
+  uint64_t k;
+  jx_result err;
+  int i, n;
+
+  JX_NOT_NULL(self);
+  JX_NOT_NULL(key);
+
+  n = jx_vector_size(self);
+  if (n < 2) return JX_OK;
+
+  /* sort copies of the items with their key in front, then copy back */
+  tsz = sizeof k + self->isz;
+  tagged = malloc(n*tsz);
+  if (NULL == tagged) return JX_OUT_OF_MEMORY;
+
+  data = jx_vector_data(self);
+  for (i = 0, item = tagged; i < n; ++i, item += tsz) {
+    k = key(&data[i*self->isz]);
+    memcpy(item, &k, sizeof k);
+    memcpy(item + sizeof k, &data[i*self->isz], self->isz);
+  }
+  err = radix_sort(tagged, n, tsz, 0, sizeof k);
+  if (JX_OK == err) {
+    for (i = 0, item = tagged; i < n; ++i, item += tsz) {
+      memcpy(&data[i*self->isz], item + sizeof k, self->isz);
+    }
+  }
+
+  free(tagged);
+  return err;
+}
+
+/******************************************************************************/
+
+void jx_merge(void *dest, const void *a, int na, const void *b, int nb,
+    size_t isz, jx_compare cmp) {
+  unsigned char *dst = dest;
+  const unsigned char *pa = a, *aend = pa + na*isz;
+  const unsigned char *pb = b, *bend = pb + nb*isz;
+
+  while (pa < aend && pb < bend) {
+    if (cmp(pb, pa) < 0) {
+      memcpy(dst, pb, isz);
+      pb += isz;
+    } else {
+      memcpy(dst, pa, isz);
+      pa += isz;
+    }
+    dst += isz;
+  }
+  memcpy(dst, pa, aend - pa);
+  memcpy(dst + (aend - pa), pb, bend - pb);
+}
+
+static void insertion_sort(unsigned char *items, int count, size_t isz,
+    jx_compare cmp, unsigned char *tmp) {
+  int i, j;
+
+  for (i = 1; i < count; ++i) {
+    /* only move past strictly greater items, so equal ones keep order */
+    for (j = i; j > 0 && cmp(&items[(j-1)*isz], &items[i*isz]) > 0; --j);
+    if (j < i) {
+      memcpy(tmp, &items[i*isz], isz);
+      memmove(&items[(j+1)*isz], &items[j*isz], (i-j)*isz);
+      memcpy(&items[j*isz], tmp, isz);
+    }
+  }
+}
+
+void jx_merge_sort(void *items, void *scratch, int count, size_t isz,
+    jx_compare cmp) {
+  unsigned char *src = items, *dst = scratch, *tmp;
+  int lo, mid, hi, width;
+
+  JX_ARRAY_SZ(count, items);
+  JX_ARRAY_SZ(count, scratch);
+  JX_POSITIVE(isz);
+  JX_NOT_NULL(cmp);
+
+  if (count < 2) return;
+
+  /* scratch is free until the first merge, borrow an item from it */
+  for (lo = 0; lo < count; lo += SMALL_RUN) {
+    hi = (lo + SMALL_RUN < count ? lo + SMALL_RUN : count);
+    insertion_sort(&src[lo*isz], hi - lo, isz, cmp, dst);
+  }
+
+  for (width = SMALL_RUN; width < count; width *= 2) {
+    for (lo = 0; lo < count; lo += 2*width) {
+      mid = (lo + width < count ? lo + width : count);
+      hi = (lo + 2*width < count ? lo + 2*width : count);
+      jx_merge(&dst[lo*isz], &src[lo*isz], mid - lo, &src[mid*isz], hi - mid,
+          isz, cmp);
+    }
+    tmp = src; src = dst; dst = tmp;
+  }
+
+  if (src != items) memcpy(items, src, count*isz);
+}
+
+jx_result jx_vector_merge_sort(jx_vector *self, jx_compare cmp) {
+  void *scratch;
+  int n;
+
+  JX_NOT_NULL(self);
+  JX_NOT_NULL(cmp);
+
+  n = jx_vector_size(self);
+  if (n < 2) return JX_OK;
+
+  scratch = malloc(n*self->isz);
+  if (NULL == scratch) return JX_OUT_OF_MEMORY;
+  jx_merge_sort(jx_vector_data(self), scratch, n, self->isz, cmp);
+  free(scratch);
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+/* records with a key and their original position, to check stability */
+struct record {
+  uint32_t id;
+  uint16_t key;
+  uint16_t pad;
+  double weight;
+};
+
+static jx_vector sort_var, *records = &sort_var;
+
+static jx_test make_records(int n) {
+  struct record *r;
+  int i;
+
+  JX_CATCH(jx_vector_init(records, sizeof *r, 0, NULL));
+  JX_CATCH(jx_vector_append(records, n, &r));
+  for (i = 0; i < n; ++i) {
+    r[i].id = i;
+    /* lots of duplicates, and keys that need both key bytes */
+    r[i].key = (uint16_t)((i * 40503u) % 1031u * 61u);
+    r[i].pad = 0;
+    r[i].weight = -i;
+  }
+  return JX_PASS;
+}
+
+static jx_test check_records() {
+  struct record *r = jx_vector_data(records);
+  int i;
+
+  for (i = 1; i < jx_vector_size(records); ++i) {
+    JX_EXPECT(r[i-1].key <= r[i].key, "The records aren't sorted.");
+    JX_EXPECT(r[i-1].key < r[i].key || r[i-1].id < r[i].id,
+        "The sort isn't stable.");
+    JX_EXPECT(r[i].weight == -(double)r[i].id, "A record was mangled.");
+  }
+  return JX_PASS;
+}
+
+static int compare_records(const void *a, const void *b) {
+  const struct record *x = a, *y = b;
+  return (x->key > y->key) - (x->key < y->key);
+}
+
+static uint64_t record_key(const void *item) {
+  return ((const struct record*)item)->key;
+}
+
+jx_test sort_radix() {
+  jx_test result = make_records(5000);
+  if (result.file) return result;
+
+  JX_CATCH(jx_vector_radix_sort(records, offsetof(struct record, key),
+        sizeof(uint16_t)));
+  result = check_records();
+  jx_vector_destroy(records);
+  return result;
+}
+
+jx_test sort_radix_by() {
+  jx_test result = make_records(3001);
+  if (result.file) return result;
+
+  JX_CATCH(jx_vector_radix_sort_by(records, record_key));
+  result = check_records();
+  jx_vector_destroy(records);
+  return result;
+}
+
+jx_test sort_merge() {
+  jx_test result = make_records(4099);
+  if (result.file) return result;
+
+  JX_CATCH(jx_vector_merge_sort(records, compare_records));
+  result = check_records();
+  jx_vector_destroy(records);
+  return result;
+}
+
+#endif
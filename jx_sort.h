@@ -0,0 +1,43 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_SORT_H
+#define JX_SORT_H
+#include "jinks.h"
+
+/* All of the sorts below are stable: items that compare equal (or have equal
+ * keys) keep their relative order. */
+
+/* LSD radix sort on an unsigned integer key of width bytes (1 to 8) stored at
+ * offset bytes into each item, in the machine's byte order. Whole items are
+ * moved on each pass, and passes where every item has the same key byte are
+ * skipped.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_vector_radix_sort(jx_vector *self, size_t offset, size_t width);
+
+/* Radix sort on the key returned by key, which is called once per item.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_vector_radix_sort_by(jx_vector *self, jx_key_fn key);
+
+/* Merge sort with a general comparator. For a multi-threaded version, see
+ * jx_parallel_sort.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_vector_merge_sort(jx_vector *self, jx_compare cmp);
+
+/******************************************************************************/
+
+/* Merge sort count items of isz bytes in place, scratch must have room for
+ * the same number of items. */
+void jx_merge_sort(void *items, void *scratch, int count, size_t isz,
+    jx_compare cmp);
+
+/* Merge the sorted arrays a and b into dest, taking from a on ties. */
+void jx_merge(void *dest, const void *a, int na, const void *b, int nb,
+    size_t isz, jx_compare cmp);
+
+#endif /* end of header guard */
@@ -0,0 +1,468 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_string.h"
+#include "jx_pointer.h"
+#include "jx_slice.h"
+#include "jx_vector.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  assert((!self->small || self->len < sizeof self->buf.local) && \
+      "Invalid object: short string is too long.")
+
+/* room in a short string, leaving space for the terminator */
+#define LOCAL_CAP ((int)sizeof(((jx_string*)0)->buf.local) - 1)
+
+void jx_string_init(jx_string *out_self) {
+  JX_NOT_NULL(out_self);
+
+  out_self->small = true;
+  out_self->len = 0;
+  out_self->buf.local[0] = '\0';
+}
+
+jx_result jx_string_init_cstr(jx_string *out_self, const char *cstr) {
+  jx_string_init(out_self);
+  return jx_string_append_cstr(out_self, cstr);
+}
+
+void jx_string_destroy(void *string) {
+  jx_string *self = string;
+  VALID(self);
+
+  if (!self->small) jx_vector_destroy(&self->buf.vec);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+int jx_string_length(const jx_string *self) {
+  VALID(self);
+  return (self->small ? self->len : jx_vector_size(&self->buf.vec));
+}
+
+int jx_string_capacity(const jx_string *self) {
+  VALID(self);
+  return (self->small ? LOCAL_CAP : jx_vector_capacity(&self->buf.vec) - 1);
+}
+
+jx_result jx_string_reserve(jx_string *self, int num) {
+  jx_vector vec;
+  char *dest;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+
+  if (!self->small) {
+    return jx_vector_reserve(&self->buf.vec, num + 1);
+  }
+  if (num <= LOCAL_CAP) return JX_OK;
+
+  /* move the short string out to the heap */
+  JX_TRY(jx_vector_init(&vec, sizeof(char), num + 1, NULL));
+  jx_vector_append(&vec, self->len + 1, &dest);
+  memcpy(dest, self->buf.local, self->len + 1);
+  jx_vector_pop_back(&vec, 1);
+  self->small = false;
+  self->buf.vec = vec;
+  return JX_OK;
+}
+
+const char* jx_string_cstr(const jx_string *self) {
+  VALID(self);
+  return (self->small ? self->buf.local : jx_vector_data(&self->buf.vec));
+}
+
+char* jx_string_data(jx_string *self) {
+  return (char*)jx_string_cstr(self);
+}
+
+int jx_string_compare(const jx_string *self, const jx_string *other) {
+  int n = jx_string_length(self), m = jx_string_length(other);
+  int c = memcmp(jx_string_cstr(self), jx_string_cstr(other), n < m ? n : m);
+  return (c ? c : (n > m) - (n < m));
+}
+
+/******************************************************************************/
+
+/* Make room for num more bytes and return where they go. The caller writes
+ * them, then calls set_length. */
+static jx_result grow(jx_string *self, int num, char **out_dest) {
+  int len = jx_string_length(self);
+  int cap = jx_string_capacity(self);
+
+  if (len + num > cap) {
+    /* grow geometrically, so that appending is amortized constant time */
+    JX_TRY(jx_string_reserve(self, len + num > 2*cap ? len + num : 2*cap));
+  }
+  *out_dest = jx_string_data(self) + len;
+  return JX_OK;
+}
+
+static void set_length(jx_string *self, int length) {
+  int size;
+
+  if (self->small) {
+    self->len = (unsigned char)length;
+  } else if (length > (size = jx_vector_size(&self->buf.vec))) {
+    /* the bytes are already in the space grow reserved, this can't fail */
+    jx_vector_append(&self->buf.vec, length - size, NULL);
+  } else if (length < size) {
+    jx_vector_pop_back(&self->buf.vec, size - length);
+  }
+  jx_string_data(self)[length] = '\0';
+}
+
+jx_result jx_string_append(jx_string *self, const char *bytes, int num) {
+  char *dest;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+  JX_ARRAY_SZ(num, bytes);
+
+  JX_TRY(grow(self, num, &dest));
+  memcpy(dest, bytes, num);
+  set_length(self, jx_string_length(self) + num);
+  return JX_OK;
+}
+
+jx_result jx_string_append_cstr(jx_string *self, const char *cstr) {
+  JX_NOT_NULL(cstr);
+  return jx_string_append(self, cstr, strlen(cstr));
+}
+
+jx_result jx_string_append_char(jx_string *self, char c) {
+  return jx_string_append(self, &c, 1);
+}
+
+jx_result jx_string_append_uint(jx_string *self, unsigned long long val) {
+  char digits[20];
+  int n = sizeof digits;
+
+  /* written backwards from the end of the buffer */
+  do {
+    digits[--n] = '0' + (char)(val % 10);
+    val /= 10;
+  } while (val);
+  return jx_string_append(self, &digits[n], sizeof digits - n);
+}
+
+jx_result jx_string_append_int(jx_string *self, long long val) {
+  unsigned long long mag = (unsigned long long)val;
+
+  if (val < 0) {
+    JX_TRY(jx_string_append_char(self, '-'));
+    /* negate as unsigned, so that the most negative value is fine too */
+    mag = 0 - mag;
+  }
+  return jx_string_append_uint(self, mag);
+}
+
+jx_result jx_string_appendf(jx_string *self, const char *fmt, ...) {
+  jx_result err;
+  va_list args;
+
+  va_start(args, fmt);
+  err = jx_string_vappendf(self, fmt, args);
+  va_end(args);
+  return err;
+}
+
+jx_result jx_string_vappendf(jx_string *self, const char *fmt, va_list args) {
+  va_list again;
+  char *dest;
+  int len, room, n;
+
+  VALID(self);
+  JX_NOT_NULL(fmt);
+
+  /* format straight into the spare capacity first */
+  len = jx_string_length(self);
+  room = jx_string_capacity(self) - len;
+  va_copy(again, args);
+  n = vsnprintf(jx_string_data(self) + len, room + 1, fmt, args);
+  if (n < 0) {
+    /* an encoding error: nothing is appended */
+    va_end(again);
+    jx_string_data(self)[len] = '\0';
+    return JX_INVALID_FORMAT;
+  }
+  if (n > room) {
+    if (JX_OK != grow(self, n, &dest)) {
+      va_end(again);
+      jx_string_data(self)[len] = '\0';
+      return JX_OUT_OF_MEMORY;
+    }
+    vsnprintf(dest, n + 1, fmt, again);
+  }
+  va_end(again);
+  set_length(self, len + n);
+  return JX_OK;
+}
+
+void jx_string_truncate(jx_string *self, int length) {
+  VALID(self);
+  JX_RANGE(length, 0, jx_string_length(self)+1);
+  set_length(self, length);
+}
+
+void jx_string_clear(jx_string *self) {
+  jx_string_truncate(self, 0);
+}
+
+/******************************************************************************/
+
+static int find_byte(const char *s, int from, int n, char c) {
+  int i = from;
+#ifdef __SSE2__
+  const __m128i target = _mm_set1_epi8(c);
+  int mask;
+
+  for (; i + 16 <= n; i += 16) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+          _mm_loadu_si128((const __m128i*)&s[i]), target));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < n; ++i) {
+    if (s[i] == c) return i;
+  }
+  return -1;
+}
+
+int jx_string_find_byte(const jx_string *self, int from, char c) {
+  int n = jx_string_length(self);
+  JX_RANGE(from, 0, n+1);
+  return find_byte(jx_string_cstr(self), from, n, c);
+}
+
+int jx_string_find(const jx_string *self, int from, const char *needle,
+    int num) {
+  const char *s = jx_string_cstr(self);
+  int i = from, n = jx_string_length(self);
+
+  JX_RANGE(from, 0, n+1);
+  JX_NOT_NEG(num);
+  JX_ARRAY_SZ(num, needle);
+
+  if (0 == num) return from;
+  if (1 == num) return find_byte(s, from, n, needle[0]);
+#ifdef __SSE2__
+  {
+    /* test 16 starting points at once: a candidate must match the first
+     * and the last byte of the needle, only those get a full compare. */
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[num-1]);
+    __m128i a, b;
+    int mask, k;
+
+    for (; i + num - 1 + 16 <= n; i += 16) {
+      a = _mm_loadu_si128((const __m128i*)&s[i]);
+      b = _mm_loadu_si128((const __m128i*)&s[i + num - 1]);
+      mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+            _mm_cmpeq_epi8(b, last)));
+      while (mask) {
+        k = __builtin_ctz(mask);
+        if (0 == memcmp(&s[i + k + 1], needle + 1, num - 2)) return i + k;
+        mask &= mask - 1;
+      }
+    }
+  }
+#endif
+  for (; i + num <= n; ++i) {
+    if (s[i] == needle[0] && 0 == memcmp(&s[i], needle, num)) return i;
+  }
+  return -1;
+}
+
+jx_result jx_string_split(const jx_string *self, char delim, jx_vector *parts) {
+  jx_pointer buffer;
+  jx_slice *part;
+  const char *s;
+  jx_result err = JX_OK;
+  int start, end, n;
+
+  VALID(self);
+  JX_NOT_NULL(parts);
+  assert(sizeof(jx_slice) == parts->isz && "Expected a vector of jx_slice.");
+
+  /* the parts share one copy of the text, which outlives the string */
+  n = jx_string_length(self);
+  JX_TRY(jx_pointer_init(&buffer, n + 1, NULL));
+  s = jx_pointer_get(&buffer);
+  memcpy((char*)s, jx_string_cstr(self), n + 1);
+  for (start = 0; JX_OK == err && start <= n; start = end + 1) {
+    end = find_byte(s, start, n, delim);
+    if (end < 0) end = n;
+    err = jx_vector_append(parts, 1, &part);
+    if (JX_OK == err) {
+      part->start = start;
+      part->stride = 1;
+      part->count = end - start;
+      jx_pointer_clone(&buffer, &part->ptr);
+    }
+  }
+  jx_pointer_destroy(&buffer);
+  return err;
+}
+
+bool jx_string_valid_utf8(const jx_string *self) {
+  const unsigned char *s = (const unsigned char*)jx_string_cstr(self);
+  int i = 0, n = jx_string_length(self), k, extra;
+  unsigned long cp;
+
+  while (i < n) {
+#ifdef __SSE2__
+    /* skip 16 bytes at a time while they are all ASCII */
+    if (i + 16 <= n && 0 == _mm_movemask_epi8(
+          _mm_loadu_si128((const __m128i*)&s[i]))) {
+      i += 16;
+      continue;
+    }
+#endif
+    if (s[i] < 0x80) {
+      ++i;
+      continue;
+    }
+    if (s[i] >= 0xc2 && s[i] <= 0xdf) {
+      extra = 1; cp = s[i] & 0x1f;
+    } else if ((s[i] & 0xf0) == 0xe0) {
+      extra = 2; cp = s[i] & 0x0f;
+    } else if (s[i] >= 0xf0 && s[i] <= 0xf4) {
+      extra = 3; cp = s[i] & 0x07;
+    } else {
+      return false;
+    }
+    if (i + extra >= n) return false;
+    for (k = 1; k <= extra; ++k) {
+      if ((s[i+k] & 0xc0) != 0x80) return false;
+      cp = (cp << 6) | (s[i+k] & 0x3f);
+    }
+    /* overlong encodings, surrogates and anything past U+10FFFF */
+    if ((extra == 2 && cp < 0x800) || (extra == 3 && cp < 0x10000) ||
+        (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) {
+      return false;
+    }
+    i += extra + 1;
+  }
+  return true;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_string str_var, *str = &str_var;
+
+static const wchar_t bad_wide[] = { 0xD800, 0 };
+
+jx_test string_append() {
+  int i;
+
+  jx_string_init(str);
+  JX_EXPECT(0 == jx_string_length(str) && 0 == strcmp("", jx_string_cstr(str)),
+      "A new string should be empty.");
+
+  JX_CATCH(jx_string_append_cstr(str, "id="));
+  JX_CATCH(jx_string_append_int(str, -42));
+  JX_CATCH(jx_string_append_char(str, ' '));
+  JX_CATCH(jx_string_append_uint(str, 18446744073709551615ull));
+  JX_EXPECT(0 == strcmp("id=-42 18446744073709551615", jx_string_cstr(str)),
+      "Incorrect short string.");
+
+  /* grow past the short string */
+  for (i = 0; i < 100; ++i) {
+    JX_CATCH(jx_string_appendf(str, "[%d:%s]", i, i % 2 ? "odd" : "even"));
+  }
+  JX_EXPECT(0 == strncmp("id=-42 18446744073709551615[0:even][1:odd]",
+        jx_string_cstr(str), 42), "Long string lost its start.");
+  JX_EXPECT((int)strlen(jx_string_cstr(str)) == jx_string_length(str),
+      "The length is wrong or the string isn't terminated.");
+
+  jx_string_truncate(str, 6);
+  JX_EXPECT(0 == strcmp("id=-42", jx_string_cstr(str)), "Truncate failed.");
+
+  /* a wide character with no encoding (a lone surrogate) */
+  JX_EXPECT(JX_INVALID_FORMAT == jx_string_appendf(str, "%ls", bad_wide) &&
+      0 == strcmp("id=-42", jx_string_cstr(str)),
+      "An encoding error should append nothing.");
+  jx_string_destroy(str);
+  return JX_PASS;
+}
+
+jx_test string_find() {
+  JX_CATCH(jx_string_init_cstr(str,
+        "GET /index.html HTTP/1.1\r\nHost: example.com\r\n"
+        "Accept: */*\r\nUser-Agent: test\r\n\r\n"));
+
+  JX_EXPECT(4 == jx_string_find_byte(str, 0, '/'), "Incorrect find byte.");
+  JX_EXPECT(20 == jx_string_find_byte(str, 5, '/'), "Incorrect find byte.");
+  JX_EXPECT(-1 == jx_string_find_byte(str, 0, '#'), "Found a missing byte.");
+  JX_EXPECT(26 == jx_string_find(str, 0, "Host: ", 6),
+      "Incorrect find substring.");
+  JX_EXPECT(74 == jx_string_find(str, 0, "\r\n\r\n", 4),
+      "Incorrect find at the end.");
+  JX_EXPECT(-1 == jx_string_find(str, 30, "Host", 4),
+      "Found a substring before from.");
+
+  jx_string_destroy(str);
+  return JX_PASS;
+}
+
+jx_test string_split() {
+  jx_vector parts;
+  jx_slice *part;
+
+  JX_CATCH(jx_string_init_cstr(str, "alpha,,beta,gamma delta,"));
+  JX_CATCH(jx_vector_init(&parts, sizeof(jx_slice), 0, jx_slice_destroy));
+  JX_CATCH(jx_string_split(str, ',', &parts));
+  jx_string_destroy(str);
+
+  JX_EXPECT(5 == jx_vector_size(&parts), "Incorrect number of fields.");
+  part = jx_vector_at(&parts, 3);
+  JX_EXPECT(11 == jx_slice_count(part) &&
+      0 == memcmp("gamma delta", jx_slice_get(part, 0), 11),
+      "Incorrect field contents.");
+  JX_EXPECT(0 == jx_slice_count(jx_vector_at(&parts, 1)) &&
+      0 == jx_slice_count(jx_vector_at(&parts, 4)), "Expected empty fields.");
+
+  jx_vector_destroy(&parts);
+  return JX_PASS;
+}
+
+jx_test string_utf8() {
+  static const char *good[] = {
+    "plain ascii, long enough for the fast path",
+    "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80",
+    ""
+  };
+  static const char *bad[] = {
+    "\xc0\xaf",           /* overlong slash */
+    "\xed\xa0\x80",       /* surrogate */
+    "\xf4\x90\x80\x80",   /* past U+10FFFF */
+    "abc\xe2\x82",        /* truncated */
+    "\x80"                /* stray continuation */
+  };
+  unsigned i;
+
+  for (i = 0; i < sizeof good / sizeof *good; ++i) {
+    JX_CATCH(jx_string_init_cstr(str, good[i]));
+    JX_EXPECT(jx_string_valid_utf8(str), "Rejected valid UTF-8.");
+    jx_string_destroy(str);
+  }
+  for (i = 0; i < sizeof bad / sizeof *bad; ++i) {
+    JX_CATCH(jx_string_init_cstr(str, bad[i]));
+    JX_EXPECT(!jx_string_valid_utf8(str), "Accepted invalid UTF-8.");
+    jx_string_destroy(str);
+  }
+  return JX_PASS;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_STRING_H
+#define JX_STRING_H
+#include "jinks.h"
+#include <stdarg.h>
+
+/* A growable byte string, always NUL terminated. Short strings are stored in
+ * the jx_string itself, longer ones in a jx_vector of char. Lengths and
+ * indices are in bytes. Strings may contain NUL bytes, in which case cstr
+ * only shows the part before the first one. */
+
+void jx_string_init(jx_string *out_self);
+
+jx_result jx_string_init_cstr(jx_string *out_self, const char *cstr);
+
+void jx_string_destroy(void *string);
+
+/******************************************************************************/
+
+int jx_string_length(const jx_string *self);
+
+int jx_string_capacity(const jx_string *self);
+
+jx_result jx_string_reserve(jx_string *self, int num);
+
+const char* jx_string_cstr(const jx_string *self);
+
+char* jx_string_data(jx_string *self);
+
+int jx_string_compare(const jx_string *self, const jx_string *other);
+
+/******************************************************************************/
+
+jx_result jx_string_append(jx_string *self, const char *bytes, int num);
+
+jx_result jx_string_append_cstr(jx_string *self, const char *cstr);
+
+jx_result jx_string_append_char(jx_string *self, char c);
+
+/* Decimal integers, written straight into the string. */
+jx_result jx_string_append_int(jx_string *self, long long val);
+
+jx_result jx_string_append_uint(jx_string *self, unsigned long long val);
+
+/* printf style formatting into the end of the string. The text is only
+ * formatted a second time if it doesn't fit in the spare capacity.
+ *
+ * Errors: JX_OUT_OF_MEMORY, JX_INVALID_FORMAT (an encoding error, nothing is
+ * appended) */
+jx_result jx_string_appendf(jx_string *self, const char *fmt, ...);
+
+jx_result jx_string_vappendf(jx_string *self, const char *fmt, va_list args);
+
+void jx_string_truncate(jx_string *self, int length);
+
+void jx_string_clear(jx_string *self);
+
+/******************************************************************************/
+
+/* Searches start at byte 'from' and return an index, or -1 if there isn't a
+ * match. Both use SSE2 where it is available. */
+
+int jx_string_find_byte(const jx_string *self, int from, char c);
+
+int jx_string_find(const jx_string *self, int from, const char *needle,
+    int num);
+
+/* Append a slice (of single bytes) to parts for every field between delim
+ * bytes. The slices share one copy of the text, so they stay valid however
+ * the string changes. parts must be a vector of jx_slice.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_string_split(const jx_string *self, char delim, jx_vector *parts);
+
+bool jx_string_valid_utf8(const jx_string *self);
+
+#endif /* end of header guard */
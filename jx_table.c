@@ -0,0 +1,287 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_table.h"
+#include "jx_pointer.h"
+#include "jx_slice.h"
+#include "jx_vector.h"
+#include <stddef.h>
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_POSITIVE(jx_vector_size(&self->cols))
+
+static jx_vector* column(const jx_table *self, int col) {
+  return jx_vector_at(&self->cols, col);
+}
+
+jx_result jx_table_init(jx_table *out_self, int ncols, const size_t *widths,
+    int capacity) {
+  jx_vector *col;
+  jx_result err;
+  int c;
+
+  JX_NOT_NULL(out_self);
+  JX_NOT_NULL(widths);
+  JX_POSITIVE(ncols);
+  JX_NOT_NEG(capacity);
+
+  JX_TRY(jx_vector_init(&out_self->cols, sizeof(jx_vector), ncols,
+        jx_vector_destroy));
+  for (c = 0; c < ncols; ++c) {
+    /* reserved above, this won't fail */
+    jx_vector_append(&out_self->cols, 1, &col);
+    /* a failed init still leaves an empty vector that can be destroyed */
+    err = jx_vector_init(col, widths[c], capacity, NULL);
+    if (JX_OK != err) {
+      jx_vector_destroy(&out_self->cols);
+      return err;
+    }
+  }
+
+  VALID(out_self);
+  return JX_OK;
+}
+
+void jx_table_destroy(void *table) {
+  jx_table *self = table;
+  VALID(self);
+
+  jx_vector_destroy(&self->cols);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+int jx_table_ncols(const jx_table *self) {
+  VALID(self);
+  return jx_vector_size(&self->cols);
+}
+
+int jx_table_size(const jx_table *self) {
+  VALID(self);
+  return jx_vector_size(column(self, 0));
+}
+
+size_t jx_table_width(const jx_table *self, int col) {
+  VALID(self);
+  return column(self, col)->isz;
+}
+
+jx_result jx_table_reserve(jx_table *self, int num) {
+  int c;
+
+  VALID(self);
+  JX_NOT_NEG(num);
+
+  for (c = 0; c < jx_vector_size(&self->cols); ++c) {
+    JX_TRY(jx_vector_reserve(column(self, c), num));
+  }
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+void* jx_table_at(const jx_table *self, int col, int row) {
+  VALID(self);
+  return jx_vector_at(column(self, col), row);
+}
+
+void* jx_table_column_data(const jx_table *self, int col) {
+  VALID(self);
+  return jx_vector_data(column(self, col));
+}
+
+/******************************************************************************/
+
+jx_result jx_table_append(jx_table *self, int num) {
+  return jx_table_insert(self, jx_table_size(self), num);
+}
+
+jx_result jx_table_insert(jx_table *self, int i, int num) {
+  int c, ncols;
+
+  VALID(self);
+  JX_POSITIVE(num);
+
+  /* reserve everywhere first, so that no column grows unless all do */
+  JX_TRY(jx_table_reserve(self, jx_table_size(self) + num));
+  ncols = jx_vector_size(&self->cols);
+  for (c = 0; c < ncols; ++c) {
+    jx_vector_insert(column(self, c), i, num, NULL);
+  }
+  return JX_OK;
+}
+
+void jx_table_remove(jx_table *self, int i, int num) {
+  int c;
+
+  VALID(self);
+  for (c = 0; c < jx_vector_size(&self->cols); ++c) {
+    jx_vector_remove(column(self, c), i, num);
+  }
+}
+
+void jx_table_clear(jx_table *self) {
+  int c;
+
+  VALID(self);
+  for (c = 0; c < jx_vector_size(&self->cols); ++c) {
+    jx_vector_clear(column(self, c));
+  }
+}
+
+/******************************************************************************/
+
+jx_result jx_table_append_records(jx_table *self, const jx_vector *records,
+    const size_t *offsets) {
+  jx_slice field;
+  jx_vector *v;
+  jx_result err;
+  int c, n, row;
+
+  VALID(self);
+  JX_NOT_NULL(records);
+  JX_NOT_NULL(offsets);
+
+  n = jx_vector_size(records);
+  if (0 == n) return JX_OK;
+
+  /* each field of the records is a strided slice, packed with the same
+   * kernel as jx_slice_copy_to. */
+  JX_TRY(jx_pointer_wrap(&field.ptr, jx_vector_data(records), NULL));
+  row = jx_table_size(self);
+  err = jx_table_append(self, n);
+  for (c = 0; JX_OK == err && c < jx_vector_size(&self->cols); ++c) {
+    v = column(self, c);
+    assert(offsets[c] + v->isz <= records->isz &&
+        "The column doesn't fit in the record.");
+    field.start = offsets[c];
+    field.stride = records->isz;
+    field.count = n;
+    jx_slice_copy_to(&field, v->isz, jx_vector_at(v, row));
+  }
+  jx_pointer_destroy(&field.ptr);
+  return err;
+}
+
+jx_result jx_table_to_records(const jx_table *self, const size_t *offsets,
+    jx_vector *records) {
+  unsigned char *rec, *src;
+  jx_vector *v;
+  int c, i, n;
+
+  VALID(self);
+  JX_NOT_NULL(records);
+  JX_NOT_NULL(offsets);
+
+  n = jx_table_size(self);
+  if (0 == n) return JX_OK;
+
+  JX_TRY(jx_vector_append(records, n, &rec));
+  memset(rec, 0, n*records->isz);
+  for (c = 0; c < jx_vector_size(&self->cols); ++c) {
+    v = column(self, c);
+    assert(offsets[c] + v->isz <= records->isz &&
+        "The column doesn't fit in the record.");
+    src = jx_vector_data(v);
+    for (i = 0; i < n; ++i, src += v->isz) {
+      memcpy(&rec[i*records->isz + offsets[c]], src, v->isz);
+    }
+  }
+  return JX_OK;
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+struct reading {
+  double value;
+  int sensor;
+  char flag;
+};
+
+static jx_table table_var, *table = &table_var;
+
+static const size_t reading_widths[] = {
+  sizeof(double), sizeof(int), sizeof(char)
+};
+
+static const size_t reading_offsets[] = {
+  offsetof(struct reading, value),
+  offsetof(struct reading, sensor),
+  offsetof(struct reading, flag)
+};
+
+jx_test table_lockstep() {
+  int i, *sensors;
+
+  JX_CATCH(jx_table_init(table, 3, reading_widths, 4));
+  JX_EXPECT(3 == jx_table_ncols(table), "Incorrect number of columns.");
+  JX_EXPECT(0 == jx_table_size(table), "A new table should be empty.");
+
+  JX_CATCH(jx_table_append(table, 10));
+  for (i = 0; i < 10; ++i) {
+    *(double*)jx_table_at(table, 0, i) = i / 2.0;
+    *(int*)jx_table_at(table, 1, i) = i;
+    *(char*)jx_table_at(table, 2, i) = 'a' + i;
+  }
+
+  JX_CATCH(jx_table_insert(table, 2, 3));
+  jx_table_remove(table, 0, 2);
+  JX_EXPECT(11 == jx_table_size(table), "Incorrect table size.");
+  JX_EXPECT(2 == *(int*)jx_table_at(table, 1, 3) &&
+      'c' == *(char*)jx_table_at(table, 2, 3) &&
+      1.0 == *(double*)jx_table_at(table, 0, 3),
+      "The columns are out of step.");
+
+  sensors = jx_table_column_data(table, 1);
+  for (i = 3; i < 11; ++i) {
+    JX_EXPECT(i-1 == sensors[i], "Incorrect column contents.");
+  }
+
+  jx_table_destroy(table);
+  return JX_PASS;
+}
+
+jx_test table_records() {
+  jx_vector records;
+  struct reading *r;
+  int i;
+
+  JX_CATCH(jx_vector_init(&records, sizeof *r, 0, NULL));
+  JX_CATCH(jx_vector_append(&records, 100, &r));
+  for (i = 0; i < 100; ++i) {
+    r[i].value = -i;
+    r[i].sensor = 3*i;
+    r[i].flag = (char)i;
+  }
+
+  JX_CATCH(jx_table_init(table, 3, reading_widths, 0));
+  JX_CATCH(jx_table_append_records(table, &records, reading_offsets));
+  JX_EXPECT(100 == jx_table_size(table), "Incorrect table size.");
+  for (i = 0; i < 100; ++i) {
+    JX_EXPECT(-i == ((double*)jx_table_column_data(table, 0))[i] &&
+        3*i == ((int*)jx_table_column_data(table, 1))[i] &&
+        (char)i == ((char*)jx_table_column_data(table, 2))[i],
+        "Records weren't split into columns correctly.");
+  }
+
+  jx_vector_clear(&records);
+  JX_CATCH(jx_table_to_records(table, reading_offsets, &records));
+  JX_EXPECT(100 == jx_vector_size(&records), "Incorrect record count.");
+  r = jx_vector_data(&records);
+  for (i = 0; i < 100; ++i) {
+    JX_EXPECT(-i == r[i].value && 3*i == r[i].sensor && (char)i == r[i].flag,
+        "Columns weren't joined into records correctly.");
+  }
+
+  jx_vector_destroy(&records);
+  jx_table_destroy(table);
+  return JX_PASS;
+}
+
+#endif
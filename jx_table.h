@@ -0,0 +1,66 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_TABLE_H
+#define JX_TABLE_H
+#include "jinks.h"
+
+/* A table of rows stored column by column (structure of arrays). Each column
+ * is a jx_vector of items of its own width, and rows are appended, inserted
+ * and removed in every column at once. Scans that only need a few fields
+ * touch only those columns. */
+
+jx_result jx_table_init(jx_table *out_self, int ncols, const size_t *widths,
+    int capacity);
+
+void jx_table_destroy(void *table);
+
+/******************************************************************************/
+
+int jx_table_ncols(const jx_table *self);
+
+int jx_table_size(const jx_table *self);
+
+size_t jx_table_width(const jx_table *self, int col);
+
+jx_result jx_table_reserve(jx_table *self, int num);
+
+/******************************************************************************/
+
+void* jx_table_at(const jx_table *self, int col, int row);
+
+/* The items of a column, one after another. The buffer belongs to the table
+ * and moves when the table is resized or reserves more room. */
+void* jx_table_column_data(const jx_table *self, int col);
+
+/******************************************************************************/
+
+/* These either change every column or, on error, none of them. */
+
+jx_result jx_table_append(jx_table *self, int num);
+
+jx_result jx_table_insert(jx_table *self, int i, int num);
+
+void jx_table_remove(jx_table *self, int i, int num);
+
+void jx_table_clear(jx_table *self);
+
+/******************************************************************************/
+
+/* Append a row for every record of records. Column c is copied from
+ * offsets[c] bytes into each record.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_table_append_records(jx_table *self, const jx_vector *records,
+    const size_t *offsets);
+
+/* Append a record to records for every row, the reverse of the above. Bytes
+ * of the records that aren't covered by a column are zeroed.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_table_to_records(const jx_table *self, const size_t *offsets,
+    jx_vector *records);
+
+#endif /* end of header guard */
@@ -3,14 +3,107 @@
  * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
  *
  ******************************************************************************/
+/* for mremap */
+#define _GNU_SOURCE
 #include "jx_vector.h"
+#include "jx_slice.h"
+#include <sys/mman.h>
+#include <unistd.h>
 #define VALID(self) \
   JX_NOT_NEG(self->size); \
   JX_POSITIVE(self->isz); \
   JX_ARRAY_SZ(self->cap, self->data)
 
+/******************************************************************************/
+
+/* Mapped vectors (reserved != 0): data is the start of a reserved range of
+ * 'reserved' bytes, of which the first 'cap' are readable and writable. Both
+ * are whole pages. */
+
+static size_t page_size() {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static unsigned char* map_range(size_t bytes) {
+  void *range = mmap(NULL, bytes, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return (MAP_FAILED == range ? NULL : range);
+}
+
+/* Move the committed pages to a reserved range of 'room' bytes. */
+static jx_result map_move(jx_vector *self, size_t room) {
+  unsigned char *newdata;
+
+  if (0 == self->cap) {
+    newdata = map_range(room);
+    if (NULL == newdata) return JX_OUT_OF_MEMORY;
+    munmap(self->data, self->reserved);
+  } else {
+#ifdef MREMAP_MAYMOVE
+    /* mremap can only move a single mapping, so let go of the uncommitted
+     * tail first. If the move fails, the reservation ends at cap. */
+    munmap(self->data + self->cap, self->reserved - self->cap);
+    self->reserved = self->cap;
+    newdata = mremap(self->data, self->cap, room, MREMAP_MAYMOVE);
+    if (MAP_FAILED == newdata) return JX_OUT_OF_MEMORY;
+    /* the extension inherits the committed protection, take it back */
+    mprotect(newdata + self->cap, room - self->cap, PROT_NONE);
+#else
+    newdata = map_range(room);
+    if (NULL == newdata) return JX_OUT_OF_MEMORY;
+    if (0 != mprotect(newdata, self->cap, PROT_READ | PROT_WRITE)) {
+      munmap(newdata, room);
+      return JX_OUT_OF_MEMORY;
+    }
+    memcpy(newdata, self->data, self->size*self->isz);
+    munmap(self->data, self->reserved);
+#endif
+  }
+
+  self->data = newdata;
+  self->reserved = room;
+  return JX_OK;
+}
+
+static jx_result map_reserve(jx_vector *self, size_t req) {
+  size_t cap = self->cap, room = self->reserved;
+
+  if (req <= cap) return JX_OK;
+  /* commit in doubling steps too, to keep the number of calls down */
+  while (cap < req) cap = (cap ? cap << 1 : page_size());
+  if (cap > room) {
+    while (room < cap) room <<= 1;
+    JX_TRY(map_move(self, room));
+  }
+  if (0 != mprotect(self->data + self->cap, cap - self->cap,
+        PROT_READ | PROT_WRITE)) {
+    return JX_OUT_OF_MEMORY;
+  }
+  self->cap = cap;
+  return JX_OK;
+}
+
+static void map_shrink(jx_vector *self) {
+  size_t page = page_size();
+  size_t keep = (self->size*self->isz + page - 1) / page * page;
+
+  if (keep < self->cap) {
+    /* drop the pages, then the access to them */
+    madvise(self->data + keep, self->cap - keep, MADV_DONTNEED);
+    mprotect(self->data + keep, self->cap - keep, PROT_NONE);
+    self->cap = keep;
+  }
+}
+
+/******************************************************************************/
+
 jx_result jx_vector_init(jx_vector *out_self, size_t isz, int capacity,
     jx_destructor destroy) {
+  return jx_vector_init_aligned(out_self, isz, capacity, destroy, 0);
+}
+
+jx_result jx_vector_init_aligned(jx_vector *out_self, size_t isz, int capacity,
+    jx_destructor destroy, size_t align) {
 
    JX_NOT_NULL(out_self);
    JX_POSITIVE(isz);
@@ -18,6 +111,8 @@ jx_result jx_vector_init(jx_vector *out_self, size_t isz, int capacity,
 
    out_self->destroy = destroy;
    out_self->isz = isz;
+   out_self->align = align;
+   out_self->reserved = 0;
    out_self->size = 0;
    out_self->cap = 0;
    out_self->data = NULL;
@@ -27,12 +122,31 @@ jx_result jx_vector_init(jx_vector *out_self, size_t isz, int capacity,
    return jx_vector_reserve(out_self, capacity);
 }
 
+jx_result jx_vector_init_mapped(jx_vector *out_self, size_t isz, int capacity,
+    jx_destructor destroy, size_t reserve) {
+  size_t page = page_size();
+
+  JX_TRY(jx_vector_init(out_self, isz, 0, destroy));
+  out_self->reserved = (reserve > page ? (reserve + page - 1) / page * page
+      : page);
+  out_self->data = map_range(out_self->reserved);
+  if (NULL == out_self->data) {
+    out_self->reserved = 0;
+    return JX_OUT_OF_MEMORY;
+  }
+  return jx_vector_reserve(out_self, capacity);
+}
+
 void jx_vector_destroy(void *vector) {
   jx_vector *self = vector;
   VALID(self);
 
   jx_vector_clear(self);
-  free(self->data);
+  if (self->reserved) {
+    munmap(self->data, self->reserved);
+  } else {
+    free(self->data);
+  }
   memset(self, 0, sizeof *self);
 }
 
@@ -61,10 +175,12 @@ jx_result jx_vector_reserve(jx_vector *self, int num) {
   JX_NOT_NEG(num);
 
   req = num*self->isz;
+  if (self->reserved) return map_reserve(self, req);
   cap = self->cap;
   while (cap < req) cap = (cap ? cap << 1 : 1);
   if (cap > self->cap) {
-    newdata = realloc(self->data, cap);
+    newdata = jx_aligned_realloc(self->data, self->size*self->isz, cap,
+        self->align);
     if (NULL == newdata) return JX_OUT_OF_MEMORY;
     self->cap = cap;
     self->data = newdata;
@@ -79,11 +195,15 @@ jx_result jx_vector_shrink(jx_vector *self) {
 
   VALID(self);
 
+  if (self->reserved) {
+    map_shrink(self);
+    return JX_OK;
+  }
   req = self->isz * self->size;
   cap = self->cap;
   while ((cap >> 1)  > req) cap >>= 1;
   if (cap < self->cap) {
-    newdata = realloc(self->data, cap);
+    newdata = jx_aligned_realloc(self->data, req, cap, self->align);
     if (NULL == newdata) return JX_OUT_OF_MEMORY;
     self->cap = cap;
     self->data = newdata;
@@ -157,6 +277,18 @@ jx_result jx_vector_insert(jx_vector *self, int i, int num, jx_outptr out_ptr) {
   return JX_OK;
 }
 
+jx_result jx_vector_extend(jx_vector *self, const jx_slice *slice) {
+  void *dest;
+
+  VALID(self);
+  JX_NOT_NULL(slice);
+
+  if (0 == jx_slice_count(slice)) return JX_OK;
+  JX_TRY(jx_vector_append(self, jx_slice_count(slice), &dest));
+  jx_slice_copy_to(slice, self->isz, dest);
+  return JX_OK;
+}
+
 /******************************************************************************/
 
 void jx_vector_remove(jx_vector *self, int i, int num) {
@@ -380,7 +512,79 @@ jx_test vector_clear() {
   return JX_PASS;
 }
 
-#endif /* unit testing section */
+jx_test vector_aligned() {
+  int i, *val;
+
+  JX_CATCH(jx_vector_init_aligned(vec, sizeof(int), 3, NULL, 64));
+  for (i = 0; i < 1000; ++i) {
+    JX_CATCH(jx_vector_append(vec, 1, &val));
+    *val = i;
+    JX_EXPECT(0 == (uintptr_t)jx_vector_data(vec) % 64,
+        "The buffer lost its alignment while growing.");
+  }
+  jx_vector_pop_back(vec, 990);
+  JX_CATCH(jx_vector_shrink(vec));
+  JX_EXPECT(0 == (uintptr_t)jx_vector_data(vec) % 64,
+      "The buffer lost its alignment while shrinking.");
+  for (i = 0; i < 10; ++i) {
+    JX_EXPECT(i == *(int*)jx_vector_at(vec, i), "Incorrect vector contents.");
+  }
 
+  jx_vector_destroy(vec);
+  return JX_PASS;
+}
 
+jx_test vector_mapped() {
+  int i, n = 300000, *vals, *val;
 
+  /* a tiny reservation, so the vector has to move a few times */
+  JX_CATCH(jx_vector_init_mapped(vec, sizeof(int), 10, NULL, 1));
+  JX_EXPECT(10 <= jx_vector_capacity(vec), "Capacity wasn't committed.");
+  for (i = 0; i < n; ++i) {
+    JX_CATCH(jx_vector_append(vec, 1, &val));
+    *val = i;
+  }
+  vals = jx_vector_data(vec);
+  for (i = 0; i < n; ++i) {
+    JX_EXPECT(i == vals[i], "Incorrect contents after growing.");
+  }
+
+  jx_vector_pop_back(vec, n - 1000);
+  JX_CATCH(jx_vector_shrink(vec));
+  JX_EXPECT(jx_vector_capacity(vec) < 2000,
+      "Shrinking didn't release the unused pages.");
+  JX_CATCH(jx_vector_append(vec, 5000, &val));
+  val[4999] = 7;
+  JX_EXPECT(999 == *(int*)jx_vector_at(vec, 999) && 7 ==
+      *(int*)jx_vector_back(vec), "Incorrect contents after regrowing.");
+
+  jx_vector_destroy(vec);
+  return JX_PASS;
+}
+
+jx_test vector_extend() {
+  jx_test results;
+  jx_slice slice, rev;
+  int i;
+
+  JX_CATCH(jx_slice_init(&slice, sizeof(int), 6));
+  for (i = 0; i < 6; ++i) {
+    *(int*)jx_slice_get(&slice, i) = 5-i;
+  }
+  jx_slice_reslice(&slice, -1, -1, 6, &rev);
+  jx_slice_destroy(&slice);
+
+  JX_CATCH(jx_vector_init(vec, sizeof(int), 0, NULL));
+  JX_CATCH(jx_vector_extend(vec, &rev));
+  JX_CATCH(jx_vector_extend(vec, &rev));
+  jx_slice_destroy(&rev);
+  JX_EXPECT(12 == jx_vector_size(vec), "Incorrect vector size.");
+  JX_EXPECT(5 == *(int*)jx_vector_at(vec, 5), "Incorrect vector contents.");
+  jx_vector_pop_back(vec, 6);
+
+  results = check_vector_contents(vec);
+  jx_vector_destroy(vec);
+  return results;
+}
+
+#endif /* unit testing section */
@@ -10,6 +10,22 @@
 jx_result jx_vector_init(jx_vector *out_self, size_t isz, int capacity,
     jx_destructor destroy);
 
+/* Same as jx_vector_init, but the buffer is aligned to align bytes (a power
+ * of two: JX_CACHE_LINE, a SIMD width or the page size) and stays aligned as
+ * the vector grows and shrinks. */
+jx_result jx_vector_init_aligned(jx_vector *out_self, size_t isz, int capacity,
+    jx_destructor destroy, size_t align);
+
+/* For very large vectors: reserve bytes of address space are mapped up front
+ * (without any memory behind them) and pages are committed as the vector
+ * grows, so growing never copies. Outgrowing the reservation has the kernel
+ * move the pages to a larger range (mremap) instead of copying them, and
+ * shrinking hands the unused pages back to the system.
+ *
+ * Errors: JX_OUT_OF_MEMORY */
+jx_result jx_vector_init_mapped(jx_vector *out_self, size_t isz, int capacity,
+    jx_destructor destroy, size_t reserve);
+
 jx_result jx_vector_clone(const jx_vector *self, jx_vector *out_self);
 
 void jx_vector_destroy(void *vector);
@@ -44,6 +60,8 @@ jx_result jx_vector_append(jx_vector *self, int num, jx_outptr out_ptr);
 
 jx_result jx_vector_insert(jx_vector *self, int i, int num, jx_outptr out_ptr);
 
+jx_result jx_vector_extend(jx_vector *self, const jx_slice *slice);
+
 /******************************************************************************/
 
 void jx_vector_remove(jx_vector *self, int i, int num);
@@ -0,0 +1,367 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#include "jx_view.h"
+#include "jx_pointer.h"
+#include "jx_slice.h"
+
+#define VALID(self) \
+  JX_NOT_NULL(self); \
+  JX_RANGE(self->ndims, 1, JX_VIEW_MAX_DIMS+1); \
+  JX_POSITIVE(self->isz)
+
+/* default edge length (in items) of the square tiles used for traversal. */
+#define DEFAULT_TILE 32
+
+static void set_row_major(jx_view *self, int stride) {
+  int k;
+  for (k = self->ndims-1; k >= 0; --k) {
+    JX_NOT_NEG(self->shape[k]);
+    self->strides[k] = stride;
+    stride *= self->shape[k];
+  }
+}
+
+jx_result jx_view_init(jx_view *out_self, size_t isz, int ndims,
+    const int *shape) {
+  JX_NOT_NULL(out_self);
+  JX_NOT_NULL(shape);
+  JX_POSITIVE(isz);
+  JX_RANGE(ndims, 1, JX_VIEW_MAX_DIMS+1);
+
+  out_self->ndims = ndims;
+  out_self->start = 0;
+  out_self->isz = isz;
+  memcpy(out_self->shape, shape, ndims * sizeof *shape);
+  set_row_major(out_self, isz);
+  JX_TRY(jx_pointer_init(&out_self->ptr, isz*jx_view_count(out_self), NULL));
+  VALID(out_self);
+
+  return JX_OK;
+}
+
+void jx_view_from_slice(const jx_slice *slice, size_t isz, int ndims,
+    const int *shape, jx_view *out_view) {
+  JX_NOT_NULL(slice);
+  JX_NOT_NULL(shape);
+  JX_NOT_NULL(out_view);
+  JX_POSITIVE(isz);
+  JX_RANGE(ndims, 1, JX_VIEW_MAX_DIMS+1);
+
+  out_view->ndims = ndims;
+  out_view->start = slice->start;
+  out_view->isz = isz;
+  memcpy(out_view->shape, shape, ndims * sizeof *shape);
+  set_row_major(out_view, slice->stride);
+  assert(jx_view_count(out_view) == slice->count &&
+      "The shape doesn't match the number of items in the slice.");
+  jx_pointer_clone(&slice->ptr, &out_view->ptr);
+  VALID(out_view);
+}
+
+void jx_view_destroy(void *view) {
+  jx_view *self = view;
+  VALID(self);
+
+  jx_pointer_destroy(&self->ptr);
+  memset(self, 0, sizeof *self);
+}
+
+/******************************************************************************/
+
+int jx_view_ndims(const jx_view *self) {
+  VALID(self);
+  return self->ndims;
+}
+
+int jx_view_shape(const jx_view *self, int axis) {
+  VALID(self);
+  JX_RANGE(axis, 0, self->ndims);
+  return self->shape[axis];
+}
+
+int jx_view_count(const jx_view *self) {
+  int k, count = 1;
+  VALID(self);
+  for (k = 0; k < self->ndims; ++k) {
+    count *= self->shape[k];
+  }
+  return count;
+}
+
+bool jx_view_iscontiguous(const jx_view *self) {
+  int k, expected;
+  VALID(self);
+
+  /* row-major and dense: the innermost stride is the item size and every
+   * other stride spans exactly the axes inside it. Axes with a single item
+   * can have any stride since it is never applied. */
+  expected = self->isz;
+  for (k = self->ndims-1; k >= 0; --k) {
+    if (self->shape[k] != 1 && self->strides[k] != expected) return false;
+    expected *= self->shape[k];
+  }
+  return true;
+}
+
+static int get_byte_pos(const jx_view *self, const int *idx) {
+  int k, pos = self->start;
+  for (k = 0; k < self->ndims; ++k) {
+    pos += self->strides[k]*idx[k];
+  }
+  return pos;
+}
+
+void* jx_view_get(const jx_view *self, const int *idx) {
+  unsigned char *arr;
+  int k;
+
+  VALID(self);
+  JX_NOT_NULL(idx);
+  for (k = 0; k < self->ndims; ++k) {
+    JX_RANGE(idx[k], 0, self->shape[k]);
+  }
+  arr = jx_pointer_get(&self->ptr);
+  return &arr[get_byte_pos(self, idx)];
+}
+
+/******************************************************************************/
+
+static void copy_view(const jx_view *self, jx_view *out_view) {
+  out_view->ndims = self->ndims;
+  out_view->start = self->start;
+  out_view->isz = self->isz;
+  memcpy(out_view->shape, self->shape, sizeof self->shape);
+  memcpy(out_view->strides, self->strides, sizeof self->strides);
+  jx_pointer_clone(&self->ptr, &out_view->ptr);
+}
+
+void jx_view_reslice(const jx_view *self, int axis, int start, int step,
+    int count, jx_view *out_view) {
+  int n;
+
+  VALID(self);
+  JX_NOT_NULL(out_view);
+  JX_RANGE(axis, 0, self->ndims);
+  JX_NOT_NEG(count);
+  assert(step != 0 && "Step can't be zero.");
+
+  /* same conventions as jx_slice_reslice, applied to a single axis */
+  n = self->shape[axis];
+  if (start < 0) start += n;
+  JX_RANGE(start, 0, n);
+
+  if (step > 0 && start + step*(count-1) >= n) {
+    count = (n - 1 - start) / step + 1;
+  } else if (step < 0 && start + step*(count-1) < 0) {
+    count = start / -step + 1;
+  }
+
+  copy_view(self, out_view);
+  out_view->start += self->strides[axis]*start;
+  out_view->shape[axis] = count;
+  out_view->strides[axis] *= step;
+  VALID(out_view);
+}
+
+void jx_view_transpose(const jx_view *self, int axis1, int axis2,
+    jx_view *out_view) {
+  VALID(self);
+  JX_NOT_NULL(out_view);
+  JX_RANGE(axis1, 0, self->ndims);
+  JX_RANGE(axis2, 0, self->ndims);
+
+  copy_view(self, out_view);
+  out_view->shape[axis1] = self->shape[axis2];
+  out_view->shape[axis2] = self->shape[axis1];
+  out_view->strides[axis1] = self->strides[axis2];
+  out_view->strides[axis2] = self->strides[axis1];
+  VALID(out_view);
+}
+
+void jx_view_lane(const jx_view *self, int axis, const int *idx,
+    jx_slice *out_slice) {
+  int k, pos;
+
+  VALID(self);
+  JX_NOT_NULL(idx);
+  JX_NOT_NULL(out_slice);
+  JX_RANGE(axis, 0, self->ndims);
+
+  /* idx[axis] is ignored, the lane runs along the whole axis */
+  pos = self->start;
+  for (k = 0; k < self->ndims; ++k) {
+    if (k == axis) continue;
+    JX_RANGE(idx[k], 0, self->shape[k]);
+    pos += self->strides[k]*idx[k];
+  }
+
+  out_slice->start = pos;
+  out_slice->stride = self->strides[axis];
+  out_slice->count = self->shape[axis];
+  jx_pointer_clone(&self->ptr, &out_slice->ptr);
+}
+
+/******************************************************************************/
+
+/* advance the odometer over the axes before 'last', return false when it
+ * wraps all the way around. */
+static bool next_outer(const jx_view *self, int *idx, int last) {
+  int k;
+  for (k = last-1; k >= 0; --k) {
+    if (++idx[k] < self->shape[k]) return true;
+    idx[k] = 0;
+  }
+  return false;
+}
+
+void jx_view_foreach_tiled(const jx_view *self, int tile, jx_view_visitor fn,
+    void *ctx) {
+  int idx[JX_VIEW_MAX_DIMS];
+  int ra, ca, rows, cols, rstride, cstride;
+  int r0, c0, r, c, rend, cend;
+  unsigned char *arr, *base;
+
+  VALID(self);
+  JX_NOT_NULL(fn);
+  JX_NOT_NEG(tile);
+
+  if (0 == jx_view_count(self)) return;
+  if (0 == tile) tile = DEFAULT_TILE;
+
+  /* the two innermost axes are tiled, a 1-D view is a single row. */
+  ca = self->ndims-1;
+  ra = ca-1;
+  cols = self->shape[ca];
+  cstride = self->strides[ca];
+  rows = (ra >= 0 ? self->shape[ra] : 1);
+  rstride = (ra >= 0 ? self->strides[ra] : 0);
+
+  arr = jx_pointer_get(&self->ptr);
+  memset(idx, 0, sizeof idx);
+  do {
+    base = &arr[get_byte_pos(self, idx)];
+    for (r0 = 0; r0 < rows; r0 += tile) {
+      rend = (r0 + tile < rows ? r0 + tile : rows);
+      for (c0 = 0; c0 < cols; c0 += tile) {
+        cend = (c0 + tile < cols ? c0 + tile : cols);
+        for (r = r0; r < rend; ++r) {
+          if (ra >= 0) idx[ra] = r;
+          for (c = c0; c < cend; ++c) {
+            idx[ca] = c;
+            fn(base + r*rstride + c*cstride, idx, ctx);
+          }
+        }
+      }
+    }
+    if (ra >= 0) idx[ra] = 0;
+    idx[ca] = 0;
+  } while (ra > 0 && next_outer(self, idx, ra));
+}
+
+/******************************************************************************/
+
+#ifdef JX_TESTING
+
+static jx_view view_var, *view = &view_var;
+static jx_view view_var2, *view2 = &view_var2;
+
+/* fill a 2-D view of ints with row*100 + col */
+static void fill_matrix(jx_view *self) {
+  int idx[2];
+  for (idx[0] = 0; idx[0] < jx_view_shape(self, 0); ++idx[0]) {
+    for (idx[1] = 0; idx[1] < jx_view_shape(self, 1); ++idx[1]) {
+      *(int*)jx_view_get(self, idx) = idx[0]*100 + idx[1];
+    }
+  }
+}
+
+jx_test view_transpose() {
+  int idx[2], tidx[2], shape[] = { 3, 5 };
+
+  JX_CATCH(jx_view_init(view, sizeof(int), 2, shape));
+  fill_matrix(view);
+  JX_EXPECT(jx_view_iscontiguous(view), "A new view should be contiguous.");
+  JX_EXPECT(15 == jx_view_count(view), "Incorrect item count.");
+
+  jx_view_transpose(view, 0, 1, view2);
+  JX_EXPECT(5 == jx_view_shape(view2, 0) && 3 == jx_view_shape(view2, 1),
+      "Transpose didn't swap the shape.");
+  JX_EXPECT(!jx_view_iscontiguous(view2),
+      "A transposed view shouldn't be contiguous.");
+
+  /* the original can die, the transpose keeps the buffer alive */
+  jx_view_destroy(view);
+  for (idx[0] = 0; idx[0] < 3; ++idx[0]) {
+    for (idx[1] = 0; idx[1] < 5; ++idx[1]) {
+      tidx[0] = idx[1]; tidx[1] = idx[0];
+      JX_EXPECT(idx[0]*100 + idx[1] == *(int*)jx_view_get(view2, tidx),
+          "Transposed view has the wrong contents.");
+    }
+  }
+
+  jx_view_destroy(view2);
+  return JX_PASS;
+}
+
+jx_test view_reslice_and_lane() {
+  int i, idx[2], shape[] = { 4, 6 };
+  jx_slice lane;
+
+  JX_CATCH(jx_view_init(view, sizeof(int), 2, shape));
+  fill_matrix(view);
+
+  /* every other column, backwards: 5, 3, 1 */
+  jx_view_reslice(view, 1, -1, -2, 10, view2);
+  JX_EXPECT(4 == jx_view_shape(view2, 0) && 3 == jx_view_shape(view2, 1),
+      "Reslice produced the wrong shape.");
+  idx[0] = 2; idx[1] = 1;
+  JX_EXPECT(203 == *(int*)jx_view_get(view2, idx),
+      "Resliced view has the wrong contents.");
+  jx_view_destroy(view);
+
+  /* column 2 of the resliced view is column 1 of the original */
+  idx[0] = 0; idx[1] = 2;
+  jx_view_lane(view2, 0, idx, &lane);
+  jx_view_destroy(view2);
+  JX_EXPECT(4 == jx_slice_count(&lane), "Lane has the wrong count.");
+  for (i = 0; i < jx_slice_count(&lane); ++i) {
+    JX_EXPECT(i*100 + 1 == *(int*)jx_slice_get(&lane, i),
+        "Lane has the wrong contents.");
+  }
+
+  jx_slice_destroy(&lane);
+  return JX_PASS;
+}
+
+static int visits;
+
+static void check_visit(void *item, const int *idx, void *ctx) {
+  bool transposed = (ctx != NULL);
+  int row = idx[transposed ? 1 : 0], col = idx[transposed ? 0 : 1];
+  if (*(int*)item == row*100 + col) ++visits;
+}
+
+jx_test view_foreach_tiled() {
+  int shape[] = { 37, 70 };
+
+  JX_CATCH(jx_view_init(view, sizeof(int), 2, shape));
+  fill_matrix(view);
+
+  visits = 0;
+  jx_view_foreach_tiled(view, 8, check_visit, NULL);
+  JX_EXPECT(37*70 == visits, "Tiled traversal missed or mismatched items.");
+
+  jx_view_transpose(view, 1, 0, view2);
+  jx_view_destroy(view);
+  visits = 0;
+  jx_view_foreach_tiled(view2, 0, check_visit, view2);
+  JX_EXPECT(37*70 == visits, "Tiled traversal of a transpose failed.");
+
+  jx_view_destroy(view2);
+  return JX_PASS;
+}
+
+#endif
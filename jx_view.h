@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * 
+ * Copyright (c) 2015, Jeremy West. Distributed under the MIT license.
+ *
+ ******************************************************************************/
+#ifndef JX_VIEW_H
+#define JX_VIEW_H
+#include "jinks.h"
+
+/* An N-dimensional strided view into a shared buffer. Every axis has a count
+ * (its shape) and a stride in bytes, so reslicing and transposing a view
+ * never copy the underlying items. Like jx_slice, views share the buffer by
+ * reference counting; it is released when the last view is destroyed. */
+
+typedef void (*jx_view_visitor)(void *item, const int *idx, void *ctx);
+
+jx_result jx_view_init(jx_view *out_self, size_t isz, int ndims,
+    const int *shape);
+
+void jx_view_from_slice(const jx_slice *slice, size_t isz, int ndims,
+    const int *shape, jx_view *out_view);
+
+void jx_view_destroy(void *view);
+
+/******************************************************************************/
+
+int jx_view_ndims(const jx_view *self);
+
+int jx_view_shape(const jx_view *self, int axis);
+
+int jx_view_count(const jx_view *self);
+
+bool jx_view_iscontiguous(const jx_view *self);
+
+void* jx_view_get(const jx_view *self, const int *idx);
+
+/******************************************************************************/
+
+void jx_view_reslice(const jx_view *self, int axis, int start, int step,
+    int count, jx_view *out_view);
+
+void jx_view_transpose(const jx_view *self, int axis1, int axis2,
+    jx_view *out_view);
+
+void jx_view_lane(const jx_view *self, int axis, const int *idx,
+    jx_slice *out_slice);
+
+/******************************************************************************/
+
+/* Visit every item, blocking the two innermost axes into tile x tile squares
+ * so that transposed or column-wise views stay within cache. A tile of 0
+ * picks a default size. */
+void jx_view_foreach_tiled(const jx_view *self, int tile, jx_view_visitor fn,
+    void *ctx);
+
+#endif /* end of header guard */